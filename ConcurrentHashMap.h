@@ -0,0 +1,430 @@
+#pragma once
+
+#include "HashMap.h"
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+
+
+// A fixed number of independently locked HashMap shards. A key's shard is chosen by the high bits of its hash
+// mixed with a seed of the map's own; each shard's table mixes another seed into that same hash, so keys of one
+// shard still spread over its buckets without the key being hashed twice.
+// Lookups take the shard's lock in shared mode, so readers of the same shard proceed in parallel; iterators are
+// not exposed, use visit() instead.
+template<typename Key,
+         typename Value,
+         typename Hash = std::hash<Key>,
+         typename KeyEqual = std::equal_to<Key>,
+         typename Allocator = std::allocator<std::pair<const Key, Value>>,
+         typename Storage = ChainedStorage,
+         typename Growth = PowerOfTwoGrowth>
+class ConcurrentHashMap {
+private:
+    // The shards hash a key the way the map does, so the hash that picked the shard is passed on to it.
+    struct ShardHash {
+        Hash hash;
+        size_t seed;
+
+        size_t operator()(const Key& key) const noexcept(std::is_nothrow_invocable_v<const Hash&, const Key&>) {
+            return seededHash(hash, key, seed);
+        }
+    };
+
+    using Map = HashMap<Key, Value, ShardHash, KeyEqual, Allocator, Storage, Growth>;
+    using StoredType = std::pair<const Key, Value>;
+
+    // Each shard gets its own cache line so that locking one never invalidates its neighbours.
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        Map map;
+
+        Shard(const ShardHash& hash, const KeyEqual& keyEqual, const Allocator& allocator) :
+                map(hash, keyEqual, allocator) {}
+    };
+
+    // Shards are constructed in place: assigning a map keeps the destination's allocator, so building a
+    // default one and assigning to it would drop the caller's.
+    class ShardDeleter {
+    private:
+        size_t mCount = 0;
+
+    public:
+        ShardDeleter() = default;
+
+        explicit ShardDeleter(size_t count) : mCount(count) {}
+
+        void operator()(Shard* shards) const {
+            for (size_t i = 0; i != mCount; ++i) {
+                shards[i].~Shard();
+            }
+            ::operator delete(shards, std::align_val_t(alignof(Shard)));
+        }
+    };
+
+    std::unique_ptr<Shard[], ShardDeleter> mShards;
+    size_t mShardBits;
+    Hash mHash;
+    size_t mSeed;
+
+private:
+    // Seeded the way HashMap seeds its own hashes, so that hashes that differ only in their low bits, such as
+    // small integers, still spread over the shards, and keys chosen to collide under the mix alone do not
+    // share a shard.
+    size_t hashOf(const Key& key) const {
+        return seededHash(mHash, key, mSeed);
+    }
+
+    Shard& shardOf(size_t hash) const {
+        if (mShardBits == 0) {
+            return mShards[0];
+        }
+        return mShards[hash >> (std::numeric_limits<size_t>::digits - mShardBits)];
+    }
+
+public:
+    explicit ConcurrentHashMap(size_t shardCount = 64,
+                               Hash hash = Hash(),
+                               KeyEqual keyEqual = KeyEqual(),
+                               const Allocator& allocator = Allocator()) :
+            mShardBits(0),
+            mHash(hash),
+            mSeed(randomSeed()) {
+        while ((size_t(1) << mShardBits) < shardCount) {
+            ++mShardBits;
+        }
+        size_t count = shard_count();
+        auto* shards = static_cast<Shard*>(::operator new(sizeof(Shard) * count, std::align_val_t(alignof(Shard))));
+        size_t constructed = 0;
+        try {
+            for (; constructed != count; ++constructed) {
+                new (shards + constructed) Shard(ShardHash{hash, mSeed}, keyEqual, allocator);
+            }
+        } catch (...) {
+            ShardDeleter{constructed}(shards);
+            throw;
+        }
+        mShards = std::unique_ptr<Shard[], ShardDeleter>(shards, ShardDeleter(count));
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    size_t shard_count() const {
+        return size_t(1) << mShardBits;
+    }
+
+    // Not a snapshot: shards are counted one after another while writers may proceed.
+    size_t size() const {
+        size_t size = 0;
+        for (size_t i = 0; i != shard_count(); ++i) {
+            std::shared_lock lock(mShards[i].mutex);
+            size += mShards[i].map.size();
+        }
+        return size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void reserve(size_t count) {
+        for (size_t i = 0; i != shard_count(); ++i) {
+            std::unique_lock lock(mShards[i].mutex);
+            mShards[i].map.reserve(count / shard_count() + 1);
+        }
+    }
+
+    bool insert(const StoredType& in) {
+        size_t hash = hashOf(in.first);
+        Shard& shard = shardOf(hash);
+        std::unique_lock lock(shard.mutex);
+        return shard.map.emplaceHashed(hash, in.first, in.second).second;
+    }
+
+    bool insert(StoredType&& in) {
+        size_t hash = hashOf(in.first);
+        Shard& shard = shardOf(hash);
+        std::unique_lock lock(shard.mutex);
+        return shard.map.emplaceHashed(hash, in.first, std::move(in.second)).second;
+    }
+
+    template<typename... Args>
+    bool try_emplace(const Key& key, Args&&... args) {
+        size_t hash = hashOf(key);
+        Shard& shard = shardOf(hash);
+        std::unique_lock lock(shard.mutex);
+        return shard.map.emplaceHashed(hash, key, std::forward<Args>(args)...).second;
+    }
+
+    template<typename M>
+    bool insert_or_assign(const Key& key, M&& value) {
+        size_t hash = hashOf(key);
+        Shard& shard = shardOf(hash);
+        std::unique_lock lock(shard.mutex);
+        auto result = shard.map.emplaceHashed(hash, key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result.second;
+    }
+
+    bool erase(const Key& key) {
+        size_t hash = hashOf(key);
+        Shard& shard = shardOf(hash);
+        std::unique_lock lock(shard.mutex);
+        size_t size = shard.map.size();
+        shard.map.eraseHashed(key, hash);
+        return shard.map.size() != size;
+    }
+
+    // Lookups under a shared lock go through the const map, whose find never modifies the table.
+    bool contains(const Key& key) const {
+        size_t hash = hashOf(key);
+        const Shard& shard = shardOf(hash);
+        std::shared_lock lock(shard.mutex);
+        const Map& map = shard.map;
+        return map.findHashed(key, hash) != map.end();
+    }
+
+    // Returns a copy, since a reference would outlive the lock.
+    std::optional<Value> find(const Key& key) const {
+        size_t hash = hashOf(key);
+        const Shard& shard = shardOf(hash);
+        std::shared_lock lock(shard.mutex);
+        const Map& map = shard.map;
+        auto it = map.findHashed(key, hash);
+        if (it == map.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // Calls fn(const std::pair<const Key, Value>&) under the shard's shared lock if key is present.
+    template<typename F>
+    bool visit(const Key& key, F&& fn) const {
+        size_t hash = hashOf(key);
+        const Shard& shard = shardOf(hash);
+        std::shared_lock lock(shard.mutex);
+        const Map& map = shard.map;
+        auto it = map.findHashed(key, hash);
+        if (it == map.end()) {
+            return false;
+        }
+        fn(*it);
+        return true;
+    }
+
+    // Calls fn(std::pair<const Key, Value>&) under the shard's exclusive lock if key is present.
+    template<typename F>
+    bool visit(const Key& key, F&& fn) {
+        size_t hash = hashOf(key);
+        Shard& shard = shardOf(hash);
+        std::unique_lock lock(shard.mutex);
+        auto it = shard.map.findHashed(key, hash);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        fn(*it);
+        return true;
+    }
+
+    // Visits every entry, holding one shard's shared lock at a time.
+    template<typename F>
+    void visit_all(F&& fn) const {
+        for (size_t i = 0; i != shard_count(); ++i) {
+            std::shared_lock lock(mShards[i].mutex);
+            for (const auto& stored : static_cast<const Map&>(mShards[i].map)) {
+                fn(stored);
+            }
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i != shard_count(); ++i) {
+            std::unique_lock lock(mShards[i].mutex);
+            mShards[i].map.clear();
+        }
+    }
+};
+
+// Readers look up an immutable HashMap snapshot without taking any lock; a read is two atomic increments
+// around the lookup, so it never waits on writers, growth or other readers. Writers copy the current snapshot,
+// modify and rehash the copy off to the side, publish it with one atomic store and free the previous snapshot
+// once every reader that could still see it has left. Each write copies the whole map, so batch them
+// through update().
+template<typename Key,
+         typename Value,
+         typename Hash = std::hash<Key>,
+         typename KeyEqual = std::equal_to<Key>,
+         typename Allocator = std::allocator<std::pair<const Key, Value>>,
+         typename Storage = ChainedStorage,
+         typename Growth = PowerOfTwoGrowth>
+class RcuHashMap {
+private:
+    using Map = HashMap<Key, Value, Hash, KeyEqual, Allocator, Storage, Growth>;
+    using StoredType = std::pair<const Key, Value>;
+
+    static constexpr size_t Stripes = 64;
+
+    // Readers announce themselves in one of two generations of counters, spread over cache lines by thread.
+    struct alignas(64) ReaderCount {
+        std::atomic<size_t> count{0};
+    };
+
+    class ReadGuard {
+    private:
+        std::atomic<size_t>& mCount;
+
+    public:
+        explicit ReadGuard(const RcuHashMap& map) :
+                mCount(map.mReaders[map.mEpoch.load() & 1][stripe()].count) {
+            mCount.fetch_add(1);
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        ~ReadGuard() {
+            mCount.fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    std::atomic<const Map*> mCurrent;
+    mutable std::atomic<size_t> mEpoch;
+    mutable ReaderCount mReaders[2][Stripes];
+    std::mutex mWriteMutex;
+
+private:
+    static size_t stripe() {
+        thread_local size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % Stripes;
+        return stripe;
+    }
+
+    void drain(size_t generation) {
+        for (auto& reader : mReaders[generation]) {
+            while (reader.count.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // A reader may have sampled the epoch long before announcing itself in that generation, so both
+    // generations are drained, each after moving new readers to the other one.
+    void synchronize() {
+        for (int round = 0; round != 2; ++round) {
+            drain(mEpoch.fetch_add(1) & 1);
+        }
+    }
+
+    void publish(std::unique_ptr<const Map> next) {
+        const Map* previous = mCurrent.exchange(next.release());
+        synchronize();
+        delete previous;
+    }
+
+public:
+    explicit RcuHashMap(Hash hash = Hash(), KeyEqual keyEqual = KeyEqual(), const Allocator& allocator = Allocator()) :
+            mCurrent(new Map(hash, keyEqual, allocator)),
+            mEpoch(0) {}
+
+    RcuHashMap(const RcuHashMap&) = delete;
+
+    RcuHashMap& operator=(const RcuHashMap&) = delete;
+
+    ~RcuHashMap() {
+        delete mCurrent.load();
+    }
+
+    // Calls fn(const HashMap&) on one consistent snapshot and returns its result. References into the
+    // snapshot must not escape fn.
+    template<typename F>
+    decltype(auto) read(F&& fn) const {
+        ReadGuard guard(*this);
+        return fn(*mCurrent.load());
+    }
+
+    size_t size() const {
+        return read([](const Map& map) {
+            return map.size();
+        });
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    bool contains(const Key& key) const {
+        return read([&key](const Map& map) {
+            return map.find(key) != map.end();
+        });
+    }
+
+    std::optional<Value> find(const Key& key) const {
+        return read([&key](const Map& map) -> std::optional<Value> {
+            auto it = map.find(key);
+            if (it == map.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        });
+    }
+
+    Value at(const Key& key) const {
+        return read([&key](const Map& map) {
+            return map.at(key);
+        });
+    }
+
+    // Applies fn(HashMap&) to a private copy of the current snapshot and publishes the result atomically.
+    // The copy keeps the snapshot's allocator: a plain copy would select_on_container_copy_construction, which
+    // drops a polymorphic_allocator's resource.
+    template<typename F>
+    void update(F&& fn) {
+        std::lock_guard lock(mWriteMutex);
+        const Map* current = mCurrent.load();
+        auto next = std::make_unique<Map>(*current, current->get_allocator());
+        fn(*next);
+        publish(std::move(next));
+    }
+
+    // Copies the whole map and waits for two grace periods: O(size()) per call. Batch writes through update().
+    bool insert(const StoredType& in) {
+        bool inserted = false;
+        update([&](Map& map) {
+            inserted = map.insert(in).second;
+        });
+        return inserted;
+    }
+
+    // O(size()) per call, like insert().
+    template<typename M>
+    bool insert_or_assign(const Key& key, M&& value) {
+        bool inserted = false;
+        update([&](Map& map) {
+            inserted = map.insert_or_assign(key, std::forward<M>(value)).second;
+        });
+        return inserted;
+    }
+
+    // O(size()) per call, like insert().
+    void erase(const Key& key) {
+        update([&key](Map& map) {
+            map.erase(key);
+        });
+    }
+
+    // Publishes a fresh empty map instead of clearing a copy, but still waits for two grace periods.
+    void clear() {
+        std::lock_guard lock(mWriteMutex);
+        const Map* current = mCurrent.load();
+        publish(std::make_unique<Map>(current->hash_function(), current->key_eq(), current->get_allocator()));
+    }
+};
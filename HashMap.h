@@ -1,152 +1,2977 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <list>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
-template<typename Key, typename Value, typename Hash = std::hash<Key>>
-class HashMap {
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+// Specialize as std::true_type to keep each entry's full hash next to it: rehashing then never calls
+// Hash again, and lookups only call KeyEqual on entries whose hash matches.
+template<typename Key>
+struct StoreHash : std::false_type {};
+
+template<typename StoredType, bool StoreHash>
+struct HashNode {
+    using value_type = StoredType;
+
+    StoredType value;
+
+    template<typename... Args>
+    explicit HashNode(size_t, Args&&... args) : value(std::forward<Args>(args)...) {}
+
+    template<typename Pred>
+    bool matches(size_t, Pred& pred) const {
+        return pred(value);
+    }
+
+    template<typename HashOf>
+    size_t hash(HashOf hashOf) const noexcept(std::is_nothrow_invocable_v<HashOf&, const StoredType&>) {
+        return hashOf(value);
+    }
+};
+
+template<typename StoredType>
+struct HashNode<StoredType, true> {
+    using value_type = StoredType;
+
+    StoredType value;
+    size_t storedHash;
+
+    template<typename... Args>
+    explicit HashNode(size_t hash, Args&&... args) : value(std::forward<Args>(args)...), storedHash(hash) {}
+
+    template<typename Pred>
+    bool matches(size_t hash, Pred& pred) const {
+        return storedHash == hash && pred(value);
+    }
+
+    template<typename HashOf>
+    size_t hash(HashOf) const noexcept {
+        return storedHash;
+    }
+};
+
+// The arguments that relocate an entry into a new node. The key is only const to users of the map, so like a
+// node handle the table moves it rather than copying it. When moving the key or the value may throw, both are
+// copied instead if they can be, so that a failed relocation leaves the source entry intact.
+template<typename Key, typename Value>
+auto relocated(std::pair<const Key, Value>& value) noexcept {
+    constexpr bool Move = (std::is_nothrow_move_constructible_v<Key> && std::is_nothrow_move_constructible_v<Value>) ||
+                          !(std::is_copy_constructible_v<Key> && std::is_copy_constructible_v<Value>);
+    if constexpr (Move) {
+        return std::pair<Key&&, Value&&>(std::move(const_cast<Key&>(value.first)), std::move(value.second));
+    } else {
+        return std::pair<const Key&, const Value&>(value.first, value.second);
+    }
+}
+
+
+// The finalizer of MurmurHash3; every input bit affects every output bit. HashMap runs every hash through it,
+// since the standard library's integer and pointer hashes are the identity.
+inline size_t mixHash(size_t hash) {
+#if SIZE_MAX > 0xFFFFFFFFu
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+#else
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+#endif
+    return hash;
+}
+
+// A different seed on every call: a per-process random base advanced by a counter, so that constructing a
+// map never waits for std::random_device.
+inline size_t randomSeed() {
+    static const uint64_t base = [] {
+        std::random_device device;
+        return uint64_t(device()) << 32 | device();
+    }();
+    static std::atomic<uint64_t> counter{0};
+    uint64_t n = counter.fetch_add(1, std::memory_order_relaxed);
+    return mixHash(static_cast<size_t>(base + n * 0x9e3779b97f4a7c15ull));
+}
+
+// Hash and KeyEqual declaring is_transparent enable lookups by any type they accept, without building a Key.
+template<typename T, typename = void>
+struct IsTransparent : std::false_type {};
+
+template<typename T>
+struct IsTransparent<T, std::void_t<typename T::is_transparent>> : std::true_type {};
+
+// SipHash-1-3 of bytes under the key (k0, k1): a keyed hash whose collisions cannot be found without the key.
+inline uint64_t sipHash13(const void* data, size_t bytes, uint64_t k0, uint64_t k1) {
+    auto rotl = [](uint64_t x, int b) {
+        return x << b | x >> (64 - b);
+    };
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+    auto round = [&] {
+        v0 += v1;
+        v1 = rotl(v1, 13) ^ v0;
+        v0 = rotl(v0, 32);
+        v2 += v3;
+        v3 = rotl(v3, 16) ^ v2;
+        v0 += v3;
+        v3 = rotl(v3, 21) ^ v0;
+        v2 += v1;
+        v1 = rotl(v1, 17) ^ v2;
+        v2 = rotl(v2, 32);
+    };
+    auto compress = [&](uint64_t m) {
+        v3 ^= m;
+        round();
+        v0 ^= m;
+    };
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + bytes / 8 * 8;
+    for (; p != end; p += 8) {
+        uint64_t m;
+        std::memcpy(&m, p, 8);
+        compress(m);
+    }
+    uint64_t last = uint64_t(bytes) << 56;
+    for (size_t i = 0; i != bytes % 8; ++i) {
+        last |= uint64_t(p[i]) << (8 * i);
+    }
+    compress(last);
+    v2 ^= 0xff;
+    round();
+    round();
+    round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// The standard hashes of strings and string views, which take no seed: keys that collide under them collide
+// under every seed, and a reseed cannot separate them.
+template<typename Hash>
+struct StringHash : std::false_type {};
+
+template<typename CharT, typename Traits, typename Alloc>
+struct StringHash<std::hash<std::basic_string<CharT, Traits, Alloc>>> : std::true_type {
+    using View = std::basic_string_view<CharT, Traits>;
+};
+
+template<typename CharT, typename Traits>
+struct StringHash<std::hash<std::basic_string_view<CharT, Traits>>> : std::true_type {
+    using View = std::basic_string_view<CharT, Traits>;
+};
+
+// The hash of key under seed. A standard string hash is replaced by SipHash-1-3 of the characters keyed by the
+// seed, so that a new seed separates any keys. Other hashes are mixed with the seed, which spreads keys whose
+// hashes agree only in the bits used for indexing, the usual outcome of a flooding attack; keys whose whole
+// hashes collide need a seeded Hash.
+template<typename Hash, typename K>
+size_t seededHash(const Hash& hash, const K& key, size_t seed) noexcept(
+        std::is_nothrow_invocable_v<const Hash&, const K&>) {
+    if constexpr (StringHash<Hash>::value) {
+        typename StringHash<Hash>::View view(key);
+        return static_cast<size_t>(sipHash13(view.data(), view.size() * sizeof(*view.data()), seed, 0));
+    } else {
+        return mixHash(hash(key) ^ seed);
+    }
+}
+
+
+// Bucket counts are powers of two and indexing is a single mask.
+class PowerOfTwoGrowth {
 private:
-    using StoredType = std::pair<const Key, Value>;
-    using StoredIterator = typename std::list<StoredType>::iterator;
-    using StoredConstIterator = typename std::list<StoredType>::const_iterator;
-    using Bucket = std::list<StoredType>;
-    using BucketIterator = typename std::vector<Bucket>::iterator;
-    using BucketConstIterator = typename std::vector<Bucket>::const_iterator;
+    size_t mMask;
+
+public:
+    // Growing to a multiple of the old count only moves entries of bucket i to buckets congruent to i.
+    static constexpr bool SplitsBuckets = true;
+
+    static size_t round_up(size_t bucketCount) {
+        size_t rounded = 1;
+        while (rounded < bucketCount) {
+            rounded *= 2;
+        }
+        return rounded;
+    }
+
+    explicit PowerOfTwoGrowth(size_t bucketCount) : mMask(bucketCount - 1) {}
+
+    size_t index(size_t hash) const {
+        return hash & mMask;
+    }
+};
+
+// Bucket counts are primes, which tolerate hashes with poorly distributed bits. The modulus is computed by
+// multiplying with a precomputed reciprocal of the prime instead of dividing.
+class PrimeGrowth {
+private:
+    static constexpr size_t Primes[] = {
+            5ul, 17ul, 29ul, 37ul, 53ul, 67ul, 79ul, 97ul, 131ul, 193ul, 257ul, 389ul, 521ul, 769ul, 1031ul,
+            1543ul, 2053ul, 3079ul, 6151ul, 12289ul, 24593ul, 49157ul, 98317ul, 196613ul, 393241ul, 786433ul,
+            1572869ul, 3145739ul, 6291469ul, 12582917ul, 25165843ul, 50331653ul, 100663319ul, 201326611ul,
+            402653189ul, 805306457ul, 1610612741ul, 3221225473ul, 4294967291ul
+    };
+
+    size_t mPrime;
+    uint64_t mReciprocal;
+
+#if defined(__SIZEOF_INT128__)
+    // __extension__ keeps -Wpedantic quiet about the non-standard type.
+    __extension__ typedef unsigned __int128 Wide;
+#endif
+
+public:
+    static constexpr bool SplitsBuckets = false;
+
+    static size_t round_up(size_t bucketCount) {
+        auto it = std::lower_bound(std::begin(Primes), std::end(Primes), bucketCount);
+        if (it == std::end(Primes)) {
+            throw std::length_error("PrimeGrowth: bucket count too large");
+        }
+        return *it;
+    }
+
+    explicit PrimeGrowth(size_t bucketCount) :
+            mPrime(bucketCount),
+            mReciprocal(UINT64_MAX / bucketCount + 1) {}
+
+    size_t index(size_t hash) const {
+#if defined(__SIZEOF_INT128__)
+        uint64_t folded = static_cast<uint32_t>(static_cast<uint64_t>(hash) ^ (static_cast<uint64_t>(hash) >> 32));
+        uint64_t fraction = mReciprocal * folded;
+        return static_cast<size_t>((static_cast<Wide>(fraction) * mPrime) >> 64);
+#else
+        return hash % mPrime;
+#endif
+    }
+};
+
+
+inline size_t countTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline size_t countLeadingZeros(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - index;
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+inline void prefetchRead(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#elif defined(_M_X64) || defined(_M_IX86)
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    (void) address;
+#endif
+}
+
+// Runs fn(begin, end) over threads contiguous chunks of [0, count), one of them on the calling thread. The
+// first exception thrown by a chunk is rethrown once every chunk has finished. A single chunk runs inline and
+// allocates nothing.
+template<typename Fn>
+void parallelFor(size_t threads, size_t count, Fn fn) {
+    threads = std::max<size_t>(1, std::min(threads, count));
+    if (threads == 1) {
+        fn(size_t(0), count);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(threads);
+    auto run = [&](size_t chunk) {
+        try {
+            fn(count * chunk / threads, count * (chunk + 1) / threads);
+        } catch (...) {
+            errors[chunk] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t chunk = 1; chunk != threads; ++chunk) {
+        try {
+            workers.emplace_back(run, chunk);
+        } catch (const std::system_error&) {
+            run(chunk);
+        }
+    }
+    run(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// What HashMap::memory_usage() reports, in bytes of heap memory.
+struct HashMapMemoryUsage {
+    // Chain heads, or the probing index of OrderedStorage.
+    size_t buckets = 0;
+    // Entries with what the storage keeps next to each: list links, stored hashes and, for the flat and
+    // ordered storages, the free slots too.
+    size_t entries = 0;
+    // Occupancy bitmaps and control bytes.
+    size_t metadata = 0;
+    // An estimate of what malloc adds to every allocation for its header and size rounding.
+    size_t allocator_slack = 0;
+
+    size_t allocated() const {
+        return buckets + entries + metadata;
+    }
+
+    size_t total() const {
+        return allocated() + allocator_slack;
+    }
+};
+
+// Slack of count allocations of bytes each under a glibc-like malloc: one word of header, sizes rounded up
+// to 16 bytes, chunks of at least 32.
+inline size_t allocationSlack(size_t bytes, size_t count = 1) {
+    if (bytes == 0) {
+        return 0;
+    }
+    size_t chunk = std::max<size_t>(32, (bytes + sizeof(void*) + 15) / 16 * 16);
+    return (chunk - bytes) * count;
+}
+
+// Smallest t for which a Poisson variable of the given mean exceeds t with probability at most tail: the
+// length a chain at that mean load practically never passes. Summed down from far above the mean, in logs
+// so that large means do not underflow; 0 past a million, where every lookup is a scan anyway.
+inline size_t poissonQuantile(double mean, double tail) {
+    if (!(mean < 1e6)) {
+        return 0;
+    }
+    double k = std::ceil(mean + 40 * std::sqrt(mean) + 40);
+    double logP = k * std::log(mean) - mean - std::lgamma(k + 1);
+    // P(X > k)
+    double above = 0;
+    for (; k > 0; --k) {
+        double p = std::exp(logP);
+        if (above + p > tail) {
+            break;
+        }
+        above += p;
+        logP += std::log(k) - std::log(mean);
+    }
+    return static_cast<size_t>(k);
+}
+
+// Size of a std::list node holding T, estimated as two links followed by the element.
+template<typename T>
+constexpr size_t listNodeBytes() {
+    return (2 * sizeof(void*) + alignof(T) - 1) / alignof(T) * alignof(T) + sizeof(T);
+}
+
+// One bit per bucket, set while the bucket holds anything, so that a scan skips 64 empty buckets per word.
+template<typename Allocator>
+class BucketBitmap {
+private:
+    using WordAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<uint64_t>;
+
+    std::vector<uint64_t, WordAllocator> mWords;
+
+    static size_t wordsFor(size_t bucketCount) {
+        return (bucketCount + 63) / 64;
+    }
+
+public:
+    BucketBitmap(size_t bucketCount, const Allocator& allocator) :
+            mWords(wordsFor(bucketCount), 0, WordAllocator(allocator)) {}
+
+    // First set bit at or after index, or bucketCount if there is none.
+    static size_t next(const uint64_t* words, size_t index, size_t bucketCount) {
+        if (index >= bucketCount) {
+            return bucketCount;
+        }
+        size_t word = index / 64;
+        uint64_t bits = words[word] & (~uint64_t(0) << (index % 64));
+        while (bits == 0) {
+            if (++word == wordsFor(bucketCount)) {
+                return bucketCount;
+            }
+            bits = words[word];
+        }
+        return word * 64 + countTrailingZeros(bits);
+    }
+
+    const uint64_t* data() const {
+        return mWords.data();
+    }
+
+    size_t bytes() const {
+        return mWords.capacity() * sizeof(uint64_t);
+    }
+
+    void set(size_t index) {
+        mWords[index / 64] |= uint64_t(1) << (index % 64);
+    }
+
+    void reset(size_t index) {
+        mWords[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+
+    void assign(size_t bucketCount) {
+        mWords.assign(wordsFor(bucketCount), 0);
+    }
+
+    void swap(BucketBitmap& rhs) noexcept {
+        mWords.swap(rhs.mWords);
+    }
+};
+
+
+struct ChainedStorage {
+    template<typename Node, typename Allocator, typename Growth>
+    class Table {
+    private:
+        using StoredType = typename Node::value_type;
+        using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+        using Bucket = std::list<Node, NodeAllocator>;
+        using BucketAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Bucket>;
+        using StoredIterator = typename Bucket::iterator;
+        using StoredConstIterator = typename Bucket::const_iterator;
+        using BucketIterator = typename std::vector<Bucket, BucketAllocator>::iterator;
+        using BucketConstIterator = typename std::vector<Bucket, BucketAllocator>::const_iterator;
+        using Bitmap = BucketBitmap<Allocator>;
+
+        // Moves between occupied buckets through the bitmap, so empty ones are never touched.
+        template<typename BIter, typename SIter, typename T>
+        class iterator_impl {
+            friend class Table;
+
+        private:
+            BIter mBuckets;
+            const uint64_t* mOccupied;
+            size_t mIndex;
+            size_t mBucketCount;
+            SIter mStored;
+
+            iterator_impl(BIter buckets, const uint64_t* occupied, size_t index, size_t bucketCount, SIter stored) :
+                    mBuckets(buckets),
+                    mOccupied(occupied),
+                    mIndex(index),
+                    mBucketCount(bucketCount),
+                    mStored(stored) {}
+
+            // Positioned at the first occupied bucket from index on.
+            iterator_impl(BIter buckets, const uint64_t* occupied, size_t index, size_t bucketCount) :
+                    iterator_impl(buckets, occupied, Bitmap::next(occupied, index, bucketCount), bucketCount, SIter()) {
+                if (mIndex != mBucketCount) {
+                    mStored = mBuckets[mIndex].begin();
+                }
+            }
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = StoredType;
+            using difference_type = ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            iterator_impl() = default;
+
+            reference operator*() const {
+                return mStored->value;
+            }
+
+            pointer operator->() const {
+                return &mStored->value;
+            }
+
+            iterator_impl& operator++() {
+                if (++mStored == mBuckets[mIndex].end()) {
+                    *this = iterator_impl(mBuckets, mOccupied, mIndex + 1, mBucketCount);
+                }
+                return *this;
+            }
+
+            iterator_impl operator++(int) {
+                iterator_impl old = *this;
+                ++*this;
+                return old;
+            }
+
+            friend bool operator==(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return lhs.mIndex == rhs.mIndex && lhs.mStored == rhs.mStored;
+            }
+
+            friend bool operator!=(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return !(lhs == rhs);
+            }
+        };
+
+        // Every bucket shares the vector's allocator, which keeps splicing between them valid.
+        std::vector<Bucket, BucketAllocator> mData;
+        Bitmap mOccupied;
+        Growth mGrowth;
+        size_t mSize;
+
+        size_t indexOf(size_t hash) const {
+            return mGrowth.index(hash);
+        }
+
+        // Appends empty buckets and clears the bitmap at its new size; on failure neither changes.
+        void resize(size_t bucketCount) {
+            size_t oldSize = mData.size();
+            try {
+                Bucket empty(NodeAllocator(mData.get_allocator()));
+                mData.reserve(bucketCount);
+                while (mData.size() < bucketCount) {
+                    mData.push_back(empty);
+                }
+                mOccupied.assign(bucketCount);
+            } catch (...) {
+                // Not erase, which move-assigns buckets: with an allocator that does not propagate on move
+                // assignment, such as std::pmr's, that assigns nodes, and pair<const Key, Value> cannot be.
+                while (mData.size() > oldSize) {
+                    mData.pop_back();
+                }
+                throw;
+            }
+        }
+
+        // Workers own whole bitmap words, so none of them writes a word another one does.
+        void markOccupied(size_t threads = 1) {
+            mOccupied.assign(mData.size());
+            parallelFor(threads, (mData.size() + 63) / 64, [&](size_t begin, size_t end) {
+                for (size_t i = begin * 64; i != std::min(end * 64, mData.size()); ++i) {
+                    if (!mData[i].empty()) {
+                        mOccupied.set(i);
+                    }
+                }
+            });
+        }
+
+        static constexpr bool HashesStored = std::is_same_v<Node, HashNode<StoredType, true>>;
+
+        // Stored hashes and a noexcept Hash cannot throw, so nodes move straight to their buckets as they are
+        // visited, and a rehash allocates nothing but the new buckets.
+        template<typename HashOf>
+        static constexpr bool HashCannotThrow = noexcept(std::declval<const Node&>().hash(std::declval<HashOf&>()));
+
+        using IndexAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<size_t>;
+
+        // Otherwise the bucket every node moves to is computed before any node moves: hashOf may throw and
+        // splice does not, so a rehash either fails with the table untouched or completes. That costs a word
+        // per bucket and one per entry, from the map's allocator, for the duration of the rehash. The nodes of
+        // bucket i go to targets[offsets[i]] onwards, in chain order.
+        struct Placement {
+            std::vector<size_t, IndexAllocator> offsets;
+            std::vector<size_t, IndexAllocator> targets;
+
+            explicit Placement(const IndexAllocator& allocator) : offsets(allocator), targets(allocator) {}
+        };
+
+        template<typename HashOf>
+        Placement place(const Growth& growth, HashOf hashOf, size_t threads) const {
+            Placement placement{IndexAllocator(mData.get_allocator())};
+            placement.offsets.resize(mData.size() + 1);
+            for (size_t i = 0; i != mData.size(); ++i) {
+                placement.offsets[i + 1] = placement.offsets[i] + mData[i].size();
+            }
+            placement.targets.resize(mSize);
+            parallelFor(threads, mData.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i != end; ++i) {
+                    size_t target = placement.offsets[i];
+                    for (const Node& node : mData[i]) {
+                        placement.targets[target++] = growth.index(node.hash(hashOf));
+                    }
+                }
+            });
+            return placement;
+        }
+
+        // Moves the nodes that buckets [begin, end) of from held when placement was made. Nodes spliced into one
+        // of those buckets meanwhile land behind them and are not visited.
+        void moveNodes(std::vector<Bucket, BucketAllocator>& from, const Placement& placement, size_t begin,
+                       size_t end) noexcept {
+            bool inPlace = &from == &mData;
+            for (size_t i = begin; i != end; ++i) {
+                auto it = from[i].begin();
+                for (size_t k = placement.offsets[i]; k != placement.offsets[i + 1]; ++k) {
+                    auto next = std::next(it);
+                    size_t target = placement.targets[k];
+                    if (!inPlace || target != i) {
+                        mData[target].splice(mData[target].end(), from[i], it);
+                    }
+                    it = next;
+                }
+            }
+        }
+
+        // Moves the nodes of buckets [begin, end) of from by hashes that cannot throw. A node spliced into a
+        // bucket still to be visited is visited again and stays where it is.
+        template<typename HashOf>
+        void moveNodes(std::vector<Bucket, BucketAllocator>& from, HashOf hashOf, size_t begin, size_t end) noexcept {
+            bool inPlace = &from == &mData;
+            for (size_t i = begin; i != end; ++i) {
+                for (auto it = from[i].begin(); it != from[i].end();) {
+                    auto next = std::next(it);
+                    size_t target = indexOf(it->hash(hashOf));
+                    if (!inPlace || target != i) {
+                        mData[target].splice(mData[target].end(), from[i], it);
+                    }
+                    it = next;
+                }
+            }
+        }
+
+        iterator_impl<BucketIterator, StoredIterator, StoredType> at(size_t index, StoredIterator stored) {
+            return {mData.begin(), mOccupied.data(), index, mData.size(), stored};
+        }
+
+        iterator_impl<BucketConstIterator, StoredConstIterator, const StoredType> at(size_t index,
+                                                                                     StoredConstIterator stored) const {
+            return {mData.begin(), mOccupied.data(), index, mData.size(), stored};
+        }
+
+    public:
+        using iterator = iterator_impl<BucketIterator, StoredIterator, StoredType>;
+        using const_iterator = iterator_impl<BucketConstIterator, StoredConstIterator, const StoredType>;
+
+        static constexpr float DefaultMaxLoadFactor = 0.5f;
+        static constexpr float MaxLoadFactorLimit = std::numeric_limits<float>::max();
+        static constexpr bool KeepsInsertionOrder = false;
+        static constexpr bool SupportsParallel = true;
+
+        // Chains of random keys are Poisson at the load; a longer one turns up about once in 10^14 buckets
+        // unless the keys collide.
+        static size_t reseed_threshold_for(float maxLoadFactor) {
+            return poissonQuantile(maxLoadFactor, 1e-14);
+        }
+
+        Table(size_t bucketCount, const Allocator& allocator) :
+                mData(BucketAllocator(allocator)),
+                mOccupied(Growth::round_up(bucketCount), allocator),
+                mGrowth(Growth::round_up(bucketCount)),
+                mSize(0) {
+            resize(Growth::round_up(bucketCount));
+        }
+
+        Table(const Table& rhs, const Allocator& allocator) : Table(rhs.mData.size(), allocator) {
+            const uint64_t* occupied = rhs.mOccupied.data();
+            for (size_t i = Bitmap::next(occupied, 0, rhs.mData.size()); i != rhs.mData.size();
+                 i = Bitmap::next(occupied, i + 1, rhs.mData.size())) {
+                mData[i].insert(mData[i].end(), rhs.mData[i].begin(), rhs.mData[i].end());
+                mOccupied.set(i);
+            }
+            mSize = rhs.mSize;
+        }
+
+        // Leaves rhs without buckets. The map never looks up or inserts into an empty table without
+        // rehashing it first, and everything else works on no buckets at all.
+        Table(Table&& rhs) noexcept :
+                mData(std::move(rhs.mData)),
+                mOccupied(std::move(rhs.mOccupied)),
+                mGrowth(rhs.mGrowth),
+                mSize(std::exchange(rhs.mSize, 0)) {}
+
+        Allocator get_allocator() const {
+            return Allocator(mData.get_allocator());
+        }
+
+        size_t size() const {
+            return mSize;
+        }
+
+        size_t occupied() const {
+            return mSize;
+        }
+
+        size_t bucket_count() const {
+            return mData.size();
+        }
+
+        void prefetch(size_t hash) const {
+            prefetchRead(&mData[indexOf(hash)]);
+        }
+
+        size_t bucket_of(size_t hash) const {
+            return indexOf(hash);
+        }
+
+        // Calls fn with the position of every entry in its chain, counting from 1.
+        template<typename HashOf, typename Fn>
+        void for_each_probe_length(HashOf, Fn fn) const {
+            const uint64_t* occupied = mOccupied.data();
+            for (size_t i = Bitmap::next(occupied, 0, mData.size()); i != mData.size();
+                 i = Bitmap::next(occupied, i + 1, mData.size())) {
+                size_t length = 0;
+                for (size_t n = mData[i].size(); length != n;) {
+                    fn(++length);
+                }
+            }
+        }
+
+        // Entries a lookup that misses at hash compares against.
+        size_t probe_length(size_t hash) const {
+            return mData[indexOf(hash)].size();
+        }
+
+        // Stored hashes are only overwritten once every new one has been computed, and then the nodes move in
+        // place without allocating.
+        template<typename HashOf>
+        void relink(HashOf hashOf) {
+            if constexpr (HashesStored) {
+                std::vector<size_t, IndexAllocator> hashes(IndexAllocator(mData.get_allocator()));
+                hashes.reserve(mSize);
+                for (const auto& bucket : mData) {
+                    for (const auto& node : bucket) {
+                        hashes.push_back(hashOf(node.value));
+                    }
+                }
+                auto hash = hashes.begin();
+                for (auto& bucket : mData) {
+                    for (auto& node : bucket) {
+                        node.storedHash = *hash++;
+                    }
+                }
+                moveNodes(mData, hashOf, 0, mData.size());
+                markOccupied();
+            } else {
+                rehash(mData.size(), hashOf);
+            }
+        }
+
+        HashMapMemoryUsage memory_usage() const {
+            constexpr size_t NodeBytes = listNodeBytes<Node>();
+            HashMapMemoryUsage usage;
+            usage.buckets = mData.capacity() * sizeof(Bucket);
+            usage.entries = mSize * NodeBytes;
+            usage.metadata = mOccupied.bytes();
+            usage.allocator_slack = allocationSlack(usage.buckets) + allocationSlack(NodeBytes, mSize) +
+                                    allocationSlack(usage.metadata);
+            return usage;
+        }
+
+        iterator begin() {
+            return iterator(mData.begin(), mOccupied.data(), 0, mData.size());
+        }
+
+        iterator end() {
+            return at(mData.size(), StoredIterator());
+        }
+
+        const_iterator begin() const {
+            return const_iterator(mData.cbegin(), mOccupied.data(), 0, mData.size());
+        }
+
+        const_iterator end() const {
+            return at(mData.size(), StoredConstIterator());
+        }
+
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred) {
+            size_t index = indexOf(hash);
+            for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
+                if (it->matches(hash, pred)) {
+                    return at(index, it);
+                }
+            }
+            return end();
+        }
+
+        template<typename Pred>
+        const_iterator find(size_t hash, Pred pred) const {
+            size_t index = indexOf(hash);
+            for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
+                if (it->matches(hash, pred)) {
+                    return at(index, it);
+                }
+            }
+            return end();
+        }
+
+        // A chain knows its length without a walk.
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred, size_t& missLength) {
+            iterator it = find(hash, pred);
+            if (it == end()) {
+                missLength = probe_length(hash);
+            }
+            return it;
+        }
+
+        template<typename... Args>
+        iterator emplace(size_t hash, Args&&... args) {
+            size_t index = indexOf(hash);
+            auto pos = mData[index].emplace(mData[index].end(), hash, std::forward<Args>(args)...);
+            mOccupied.set(index);
+            ++mSize;
+            return at(index, pos);
+        }
+
+        void erase(iterator pos) {
+            Bucket& bucket = mData[pos.mIndex];
+            bucket.erase(pos.mStored);
+            if (bucket.empty()) {
+                mOccupied.reset(pos.mIndex);
+            }
+            --mSize;
+        }
+
+        static size_t bucket_count_for(size_t bucketCount) {
+            return Growth::round_up(bucketCount);
+        }
+
+        // Nodes are allocated as they are inserted; the buckets are all there is to reserve.
+        void reserve(size_t) {}
+
+        // Nodes are relinked rather than copied, so references to elements survive growth and shrinking.
+        template<typename HashOf>
+        void rehash(size_t bucketCount, HashOf hashOf) {
+            bucketCount = Growth::round_up(bucketCount);
+            Growth growth(bucketCount);
+            std::optional<Placement> placement;
+            if constexpr (!HashCannotThrow<HashOf>) {
+                placement.emplace(place(growth, hashOf, 1));
+            }
+            auto move = [&](std::vector<Bucket, BucketAllocator>& from, size_t end) {
+                if constexpr (HashCannotThrow<HashOf>) {
+                    moveNodes(from, hashOf, 0, end);
+                } else {
+                    moveNodes(from, *placement, 0, end);
+                }
+            };
+            if (bucketCount < mData.size()) {
+                std::vector<Bucket, BucketAllocator> data(mData.get_allocator());
+                data.swap(mData);
+                try {
+                    resize(bucketCount);
+                } catch (...) {
+                    data.swap(mData);
+                    throw;
+                }
+                mGrowth = growth;
+                move(data, data.size());
+            } else {
+                size_t oldSize = mData.size();
+                resize(bucketCount);
+                mGrowth = growth;
+                move(mData, oldSize);
+            }
+            markOccupied();
+        }
+
+        // Growth that splits buckets sends the nodes of bucket i only to buckets congruent to i modulo the old
+        // count, so workers owning disjoint ranges of old buckets never touch the same bucket.
+        template<typename HashOf>
+        void rehash(size_t bucketCount, HashOf hashOf, size_t threads) {
+            size_t oldSize = mData.size();
+            bucketCount = Growth::round_up(bucketCount);
+            if (!Growth::SplitsBuckets || threads <= 1 || bucketCount < oldSize || bucketCount % oldSize != 0) {
+                rehash(bucketCount, hashOf);
+                return;
+            }
+            Growth growth(bucketCount);
+            std::optional<Placement> placement;
+            if constexpr (!HashCannotThrow<HashOf>) {
+                placement.emplace(place(growth, hashOf, threads));
+            }
+            resize(bucketCount);
+            mGrowth = growth;
+            parallelFor(threads, oldSize, [&](size_t begin, size_t end) {
+                if constexpr (HashCannotThrow<HashOf>) {
+                    moveNodes(mData, hashOf, begin, end);
+                } else {
+                    moveNodes(mData, *placement, begin, end);
+                }
+            });
+            markOccupied(threads);
+        }
+
+        // Sorts entries, pairs of a hash and an iterator to the value, into slices of whole bitmap words of
+        // buckets and fills the slices from several threads. Entries whose key is already present, as found
+        // by predOf(iterator), are skipped; the table must have room for the rest.
+        template<typename Source, typename PredOf>
+        void emplace_parallel(const std::vector<std::pair<size_t, Source>>& entries, PredOf predOf, size_t threads) {
+            size_t words = (mData.size() + 63) / 64;
+            size_t slices = std::max<size_t>(1, std::min(threads * 4, words));
+            size_t sliceWidth = (words + slices - 1) / slices * 64;
+            slices = (mData.size() + sliceWidth - 1) / sliceWidth;
+            std::vector<size_t> starts(slices + 1);
+            for (const auto& entry : entries) {
+                ++starts[indexOf(entry.first) / sliceWidth + 1];
+            }
+            std::partial_sum(starts.begin(), starts.end(), starts.begin());
+            std::vector<const std::pair<size_t, Source>*> sorted(entries.size());
+            for (const auto& entry : entries) {
+                sorted[starts[indexOf(entry.first) / sliceWidth]++] = &entry;
+            }
+            std::vector<size_t> added(slices);
+            parallelFor(threads, slices, [&](size_t begin, size_t end) {
+                for (size_t slice = begin; slice != end; ++slice) {
+                    size_t first = slice == 0 ? 0 : starts[slice - 1];
+                    for (size_t i = first; i != starts[slice]; ++i) {
+                        auto [hash, source] = *sorted[i];
+                        size_t index = indexOf(hash);
+                        Bucket& bucket = mData[index];
+                        auto pred = predOf(source);
+                        auto same = [&](const Node& node) {
+                            return node.matches(hash, pred);
+                        };
+                        if (std::none_of(bucket.begin(), bucket.end(), same)) {
+                            bucket.emplace(bucket.end(), hash, *source);
+                            mOccupied.set(index);
+                            ++added[slice];
+                        }
+                    }
+                }
+            });
+            mSize += std::accumulate(added.begin(), added.end(), size_t(0));
+        }
+
+        // Only visits occupied buckets, so clearing a sparse table costs little more than its size.
+        void clear() {
+            const uint64_t* occupied = mOccupied.data();
+            for (size_t i = Bitmap::next(occupied, 0, mData.size()); i != mData.size();
+                 i = Bitmap::next(occupied, i + 1, mData.size())) {
+                mData[i].clear();
+            }
+            mOccupied.assign(mData.size());
+            mSize = 0;
+        }
+
+        void swap(Table& rhs) noexcept {
+            mData.swap(rhs.mData);
+            mOccupied.swap(rhs.mOccupied);
+            std::swap(mGrowth, rhs.mGrowth);
+            std::swap(mSize, rhs.mSize);
+        }
+    };
+};
+
+// Chained buckets that grow without a stop-the-world pass. Insertions build the bucket array of the next
+// doubling a slice at a time before it is due, so growth only switches to it, and the old array is drained and
+// destroyed a few buckets at a time by later insertions. Lookups consult both arrays until it is empty and
+// never migrate, so they leave iterators valid; like a rehash, any insertion may invalidate them. Entries
+// always keep their hash, since migrating them must not call back into Hash.
+struct IncrementalStorage {
+    template<typename Node, typename Allocator, typename Growth>
+    class Table {
+    private:
+        using StoredType = typename Node::value_type;
+        using Entry = HashNode<StoredType, true>;
+        using EntryAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+        using Bucket = std::list<Entry, EntryAllocator>;
+        using BucketAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Bucket>;
+        using BucketTraits = std::allocator_traits<BucketAllocator>;
+        using IndexAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<size_t>;
+
+        // Buckets migrated per insertion; growth is due again after about bucket_count() * max_load_factor()
+        // insertions, so anything above 1 / max_load_factor() finishes migrating before that.
+        static constexpr size_t MigrationStep = 4;
+        // Buckets of the next array built per insertion once its doubling is near.
+        static constexpr size_t PreparationStep = 64;
+
+        // A bucket array of which only buckets [mBegin, mEnd) are constructed, so that it can be built and
+        // destroyed a slice at a time.
+        class Buckets {
+        private:
+            BucketAllocator mAllocator;
+            Bucket* mBuckets;
+            size_t mSize;
+            size_t mBegin;
+            size_t mEnd;
+
+        public:
+            explicit Buckets(const BucketAllocator& allocator) :
+                    mAllocator(allocator),
+                    mBuckets(nullptr),
+                    mSize(0),
+                    mBegin(0),
+                    mEnd(0) {}
+
+            // Allocates size buckets without constructing any.
+            Buckets(size_t size, const BucketAllocator& allocator) : Buckets(allocator) {
+                mBuckets = BucketTraits::allocate(mAllocator, size);
+                mSize = size;
+            }
+
+            Buckets(Buckets&& rhs) noexcept :
+                    mAllocator(rhs.mAllocator),
+                    mBuckets(std::exchange(rhs.mBuckets, nullptr)),
+                    mSize(std::exchange(rhs.mSize, 0)),
+                    mBegin(std::exchange(rhs.mBegin, 0)),
+                    mEnd(std::exchange(rhs.mEnd, 0)) {}
+
+            Buckets& operator=(const Buckets&) = delete;
+
+            ~Buckets() {
+                reset();
+            }
+
+            BucketAllocator get_allocator() const {
+                return mAllocator;
+            }
+
+            size_t size() const {
+                return mSize;
+            }
+
+            bool complete() const {
+                return mBegin == 0 && mEnd == mSize;
+            }
+
+            Bucket* data() {
+                return mBuckets;
+            }
+
+            const Bucket* data() const {
+                return mBuckets;
+            }
+
+            Bucket& operator[](size_t index) {
+                return mBuckets[index];
+            }
+
+            const Bucket& operator[](size_t index) const {
+                return mBuckets[index];
+            }
+
+            Bucket* begin() {
+                return mBuckets + mBegin;
+            }
+
+            Bucket* end() {
+                return mBuckets + mEnd;
+            }
+
+            const Bucket* begin() const {
+                return mBuckets + mBegin;
+            }
+
+            const Bucket* end() const {
+                return mBuckets + mEnd;
+            }
+
+            // Constructs up to count more buckets after the constructed ones.
+            void construct(size_t count) {
+                Bucket empty{EntryAllocator(mAllocator)};
+                for (; count != 0 && mEnd != mSize; --count) {
+                    BucketTraits::construct(mAllocator, mBuckets + mEnd, empty);
+                    ++mEnd;
+                }
+            }
+
+            // Destroys the buckets before index, which must be empty.
+            void destroyBefore(size_t index) {
+                for (; mBegin < index; ++mBegin) {
+                    BucketTraits::destroy(mAllocator, mBuckets + mBegin);
+                }
+            }
+
+            void reset() noexcept {
+                if (mBuckets != nullptr) {
+                    for (size_t i = mBegin; i != mEnd; ++i) {
+                        BucketTraits::destroy(mAllocator, mBuckets + i);
+                    }
+                    BucketTraits::deallocate(mAllocator, mBuckets, mSize);
+                }
+                mBuckets = nullptr;
+                mSize = mBegin = mEnd = 0;
+            }
+
+            void swap(Buckets& rhs) noexcept {
+                if constexpr (BucketTraits::propagate_on_container_swap::value) {
+                    std::swap(mAllocator, rhs.mAllocator);
+                }
+                std::swap(mBuckets, rhs.mBuckets);
+                std::swap(mSize, rhs.mSize);
+                std::swap(mBegin, rhs.mBegin);
+                std::swap(mEnd, rhs.mEnd);
+            }
+        };
+
+        // Walks the buckets of the old array that are still to be migrated, then the current array.
+        template<typename BPtr, typename SIter, typename T>
+        class iterator_impl {
+            friend class Table;
+
+        private:
+            BPtr mBucket;
+            BPtr mBucketEnd;
+            BPtr mNext;
+            BPtr mNextEnd;
+            SIter mStored;
+
+            iterator_impl(BPtr bucket, BPtr bucketEnd, BPtr next, BPtr nextEnd, SIter stored) :
+                    mBucket(bucket),
+                    mBucketEnd(bucketEnd),
+                    mNext(next),
+                    mNextEnd(nextEnd),
+                    mStored(stored) {}
+
+            iterator_impl(BPtr bucket, BPtr bucketEnd, BPtr next, BPtr nextEnd) :
+                    iterator_impl(bucket, bucketEnd, next, nextEnd, SIter()) {
+                if (mBucket != mBucketEnd) {
+                    mStored = mBucket->begin();
+                }
+                settle();
+            }
+
+            void settle() {
+                while (mBucket == mBucketEnd || mStored == mBucket->end()) {
+                    if (mBucket != mBucketEnd && ++mBucket != mBucketEnd) {
+                        mStored = mBucket->begin();
+                    } else if (mBucket == mBucketEnd && mNext != mNextEnd) {
+                        mBucket = mNext;
+                        mBucketEnd = mNextEnd;
+                        mNext = mNextEnd;
+                        mStored = mBucket->begin();
+                    } else if (mBucket == mBucketEnd) {
+                        mStored = SIter();
+                        return;
+                    }
+                }
+            }
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = StoredType;
+            using difference_type = ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            iterator_impl() = default;
+
+            reference operator*() const {
+                return mStored->value;
+            }
+
+            pointer operator->() const {
+                return &mStored->value;
+            }
+
+            iterator_impl& operator++() {
+                ++mStored;
+                settle();
+                return *this;
+            }
+
+            iterator_impl operator++(int) {
+                iterator_impl old = *this;
+                ++*this;
+                return old;
+            }
+
+            friend bool operator==(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return lhs.mBucket == rhs.mBucket && lhs.mStored == rhs.mStored;
+            }
+
+            friend bool operator!=(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return !(lhs == rhs);
+            }
+        };
+
+        Buckets mData;
+        Buckets mOld;
+        // The array of the next doubling while it is being built.
+        Buckets mNext;
+        Growth mGrowth;
+        Growth mOldGrowth;
+        // Buckets of mOld below this index have been moved to mData and destroyed.
+        size_t mMigrated;
+        size_t mSize;
+        // Load at which insertions last doubled the table, where the next doubling is expected too.
+        double mGrowthLoad;
+
+        static Buckets makeBuckets(size_t bucketCount, const BucketAllocator& allocator) {
+            Buckets buckets(bucketCount, allocator);
+            buckets.construct(bucketCount);
+            return buckets;
+        }
+
+        bool migrating() const {
+            return mMigrated != mOld.size();
+        }
+
+        void migrate(size_t bucketCount) {
+            for (; bucketCount != 0 && migrating(); --bucketCount, ++mMigrated) {
+                Bucket& bucket = mOld[mMigrated];
+                while (!bucket.empty()) {
+                    Bucket& target = mData[mGrowth.index(bucket.front().storedHash)];
+                    target.splice(target.end(), bucket, bucket.begin());
+                }
+            }
+            mOld.destroyBefore(mMigrated);
+            if (!migrating()) {
+                mOld.reset();
+                mMigrated = 0;
+            }
+        }
+
+        // Starts early enough that PreparationStep buckets per insertion finish the array, twice the current
+        // one, with half of the insertions left before the doubling is due.
+        void prepare() {
+            size_t nextCount = mData.size() * 2;
+            if (mSize + 2 * nextCount / PreparationStep < mGrowthLoad * mData.size()) {
+                return;
+            }
+            if (mNext.size() == 0) {
+                Buckets(Growth::round_up(nextCount), mData.get_allocator()).swap(mNext);
+            }
+            mNext.construct(PreparationStep);
+        }
+
+        template<typename Self, typename Pred>
+        static auto findIn(Self& self, size_t hash, Pred& pred) {
+            using Iter = decltype(self.end());
+            auto old = self.mOld.data();
+            auto data = self.mData.data();
+            if (self.migrating()) {
+                size_t index = self.mOldGrowth.index(hash);
+                if (index >= self.mMigrated) {
+                    for (auto it = old[index].begin(); it != old[index].end(); ++it) {
+                        if (it->matches(hash, pred)) {
+                            return Iter(old + index, old + self.mOld.size(), data, data + self.mData.size(), it);
+                        }
+                    }
+                }
+            }
+            size_t index = self.mGrowth.index(hash);
+            for (auto it = data[index].begin(); it != data[index].end(); ++it) {
+                if (it->matches(hash, pred)) {
+                    return Iter(data + index, data + self.mData.size(), data, data, it);
+                }
+            }
+            return self.end();
+        }
+
+    public:
+        using iterator = iterator_impl<Bucket*, typename Bucket::iterator, StoredType>;
+        using const_iterator = iterator_impl<const Bucket*, typename Bucket::const_iterator, const StoredType>;
+
+        static constexpr float DefaultMaxLoadFactor = 0.5f;
+        static constexpr float MaxLoadFactorLimit = std::numeric_limits<float>::max();
+        static constexpr bool KeepsInsertionOrder = false;
+        static constexpr bool SupportsParallel = false;
+
+        // Counts the old chain and the new one while a migration is under way: an unmigrated old bucket at up
+        // to the full load and a new one at up to half of it.
+        static size_t reseed_threshold_for(float maxLoadFactor) {
+            return poissonQuantile(1.5 * maxLoadFactor, 1e-14);
+        }
+
+        Table(size_t bucketCount, const Allocator& allocator) :
+                mData(makeBuckets(Growth::round_up(bucketCount), BucketAllocator(allocator))),
+                mOld(BucketAllocator(allocator)),
+                mNext(BucketAllocator(allocator)),
+                mGrowth(mData.size()),
+                mOldGrowth(mGrowth),
+                mMigrated(0),
+                mSize(0),
+                mGrowthLoad(DefaultMaxLoadFactor) {}
+
+        Table(const Table& rhs, const Allocator& allocator) : Table(rhs.mData.size(), allocator) {
+            for (auto it = rhs.begin(); it != rhs.end(); ++it) {
+                Bucket& target = mData[mGrowth.index(it.mStored->storedHash)];
+                target.emplace(target.end(), *it.mStored);
+            }
+            mSize = rhs.mSize;
+            mGrowthLoad = rhs.mGrowthLoad;
+        }
+
+        Table(Table&& rhs) noexcept :
+                mData(std::move(rhs.mData)),
+                mOld(std::move(rhs.mOld)),
+                mNext(std::move(rhs.mNext)),
+                mGrowth(rhs.mGrowth),
+                mOldGrowth(rhs.mOldGrowth),
+                mMigrated(std::exchange(rhs.mMigrated, 0)),
+                mSize(std::exchange(rhs.mSize, 0)),
+                mGrowthLoad(rhs.mGrowthLoad) {}
+
+        Allocator get_allocator() const {
+            return Allocator(mData.get_allocator());
+        }
+
+        size_t size() const {
+            return mSize;
+        }
+
+        size_t occupied() const {
+            return mSize;
+        }
+
+        size_t bucket_count() const {
+            return mData.size();
+        }
+
+        void prefetch(size_t hash) const {
+            if (migrating() && mOldGrowth.index(hash) >= mMigrated) {
+                prefetchRead(&mOld[mOldGrowth.index(hash)]);
+            }
+            prefetchRead(&mData[mGrowth.index(hash)]);
+        }
+
+        size_t bucket_of(size_t hash) const {
+            return mGrowth.index(hash);
+        }
+
+        // Calls fn with the position of every entry in its chain, counting from 1.
+        template<typename HashOf, typename Fn>
+        void for_each_probe_length(HashOf, Fn fn) const {
+            auto visit = [&](const Bucket& bucket) {
+                size_t length = 0;
+                for (size_t n = bucket.size(); length != n;) {
+                    fn(++length);
+                }
+            };
+            std::for_each(mOld.begin(), mOld.end(), visit);
+            std::for_each(mData.begin(), mData.end(), visit);
+        }
+
+        // Entries a lookup that misses at hash compares against, in the old chain and the new one.
+        size_t probe_length(size_t hash) const {
+            size_t length = mData[mGrowth.index(hash)].size();
+            if (migrating() && mOldGrowth.index(hash) >= mMigrated) {
+                length += mOld[mOldGrowth.index(hash)].size();
+            }
+            return length;
+        }
+
+        // Unlike rehash, does not leave a migration behind: the old array is drained first, by the hashes its
+        // entries were placed with. Every new hash is computed before any node moves.
+        template<typename HashOf>
+        void relink(HashOf hashOf) {
+            migrate(mOld.size());
+            Buckets data = makeBuckets(mData.size(), mData.get_allocator());
+            std::vector<size_t, IndexAllocator> hashes(IndexAllocator(mData.get_allocator()));
+            hashes.reserve(mSize);
+            for (const auto& bucket : mData) {
+                for (const auto& node : bucket) {
+                    hashes.push_back(hashOf(node.value));
+                }
+            }
+            auto hash = hashes.begin();
+            for (auto& bucket : mData) {
+                while (!bucket.empty()) {
+                    bucket.front().storedHash = *hash++;
+                    Bucket& target = data[mGrowth.index(bucket.front().storedHash)];
+                    target.splice(target.end(), bucket, bucket.begin());
+                }
+            }
+            mData.swap(data);
+        }
+
+        // Counts every bucket array allocated: the old one while a migration is under way and the next one
+        // while it is being built.
+        HashMapMemoryUsage memory_usage() const {
+            constexpr size_t NodeBytes = listNodeBytes<Entry>();
+            HashMapMemoryUsage usage;
+            size_t data = mData.size() * sizeof(Bucket);
+            size_t old = mOld.size() * sizeof(Bucket);
+            size_t next = mNext.size() * sizeof(Bucket);
+            usage.buckets = data + old + next;
+            usage.entries = mSize * NodeBytes;
+            usage.allocator_slack = allocationSlack(data) + allocationSlack(old) + allocationSlack(next) +
+                                    allocationSlack(NodeBytes, mSize);
+            return usage;
+        }
+
+        iterator begin() {
+            Bucket* old = mOld.data();
+            Bucket* data = mData.data();
+            return iterator(old + mMigrated, old + mOld.size(), data, data + mData.size());
+        }
+
+        iterator end() {
+            Bucket* dataEnd = mData.data() + mData.size();
+            return iterator(dataEnd, dataEnd, dataEnd, dataEnd, typename Bucket::iterator());
+        }
+
+        const_iterator begin() const {
+            const Bucket* old = mOld.data();
+            const Bucket* data = mData.data();
+            return const_iterator(old + mMigrated, old + mOld.size(), data, data + mData.size());
+        }
+
+        const_iterator end() const {
+            const Bucket* dataEnd = mData.data() + mData.size();
+            return const_iterator(dataEnd, dataEnd, dataEnd, dataEnd, typename Bucket::const_iterator());
+        }
+
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred) {
+            return findIn(*this, hash, pred);
+        }
+
+        template<typename Pred>
+        const_iterator find(size_t hash, Pred pred) const {
+            return findIn(*this, hash, pred);
+        }
+
+        // Both chains know their lengths without a walk.
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred, size_t& missLength) {
+            iterator it = find(hash, pred);
+            if (it == end()) {
+                missLength = probe_length(hash);
+            }
+            return it;
+        }
+
+        template<typename... Args>
+        iterator emplace(size_t hash, Args&&... args) {
+            migrate(MigrationStep);
+            prepare();
+            Bucket* data = mData.data();
+            size_t index = mGrowth.index(hash);
+            auto pos = data[index].emplace(data[index].end(), hash, std::forward<Args>(args)...);
+            ++mSize;
+            return iterator(data + index, data + mData.size(), data, data, pos);
+        }
+
+        // Does not migrate, so that the iterator stays valid until the bucket is unlinked.
+        void erase(iterator pos) {
+            pos.mBucket->erase(pos.mStored);
+            --mSize;
+        }
+
+        static size_t bucket_count_for(size_t bucketCount) {
+            return Growth::round_up(bucketCount);
+        }
+
+        // Nodes are allocated one at a time.
+        void reserve(size_t) {}
+
+        // Switches to the prepared array if it has the requested size, finishing it first if insertions have
+        // not; any other size is built here. Shrinking migrates at once, which costs O(size()), small next to
+        // the array dropped; left to insertions, that array would linger until the map grew back.
+        template<typename HashOf>
+        void rehash(size_t bucketCount, HashOf) {
+            migrate(mOld.size());
+            bucketCount = Growth::round_up(bucketCount);
+            Buckets data(mData.get_allocator());
+            if (mNext.size() == bucketCount) {
+                mNext.construct(bucketCount);
+                data.swap(mNext);
+            } else {
+                mNext.reset();
+                makeBuckets(bucketCount, mData.get_allocator()).swap(data);
+            }
+            if (mSize != 0 && bucketCount == Growth::round_up(mData.size() * 2)) {
+                mGrowthLoad = static_cast<double>(mSize) / mData.size();
+            }
+            mOld.swap(mData);
+            mData.swap(data);
+            mOldGrowth = mGrowth;
+            mGrowth = Growth(mData.size());
+            mMigrated = 0;
+            if (mSize == 0 || mData.size() < mOld.size()) {
+                migrate(mOld.size());
+            }
+        }
+
+        void clear() {
+            for (auto& bucket : mData) {
+                bucket.clear();
+            }
+            mOld.reset();
+            mMigrated = 0;
+            mSize = 0;
+        }
+
+        void swap(Table& rhs) noexcept {
+            mData.swap(rhs.mData);
+            mOld.swap(rhs.mOld);
+            mNext.swap(rhs.mNext);
+            std::swap(mGrowth, rhs.mGrowth);
+            std::swap(mOldGrowth, rhs.mOldGrowth);
+            std::swap(mMigrated, rhs.mMigrated);
+            std::swap(mSize, rhs.mSize);
+            std::swap(mGrowthLoad, rhs.mGrowthLoad);
+        }
+    };
+};
+
+struct FlatStorage {
+private:
+    // Matches the control bytes of Width consecutive slots at once; bit i of a mask refers to slot i.
+    class BitMask {
+    private:
+        uint64_t mMask;
+
+    public:
+        explicit BitMask(uint64_t mask) : mMask(mask) {}
+
+        explicit operator bool() const {
+            return mMask != 0;
+        }
+
+        size_t lowest() const {
+            return countTrailingZeros(mMask) >> Shift;
+        }
+
+        size_t highestFromTop() const {
+            return (countLeadingZeros(mMask) - (64 - (Width << Shift))) >> Shift;
+        }
+
+        void removeLowest() {
+            mMask &= mMask - 1;
+        }
+    };
+
+    enum Control : signed char {
+        Empty = -128,
+        Deleted = -2
+    };
+
+#if defined(__AVX2__)
+    static constexpr size_t Width = 32;
+    static constexpr size_t Shift = 0;
+
+    class Group {
+    private:
+        __m256i mControl;
+
+    public:
+        explicit Group(const signed char* pos) :
+                mControl(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos))) {}
+
+        BitMask match(signed char h2) const {
+            return BitMask(static_cast<uint32_t>(
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), mControl))));
+        }
+
+        BitMask matchEmpty() const {
+            return match(Empty);
+        }
+
+        BitMask matchEmptyOrDeleted() const {
+            return BitMask(static_cast<uint32_t>(_mm256_movemask_epi8(mControl)));
+        }
+
+        BitMask matchFull() const {
+            return BitMask(~static_cast<uint32_t>(_mm256_movemask_epi8(mControl)));
+        }
+    };
+#elif defined(__SSE2__) || defined(_M_X64)
+    static constexpr size_t Width = 16;
+    static constexpr size_t Shift = 0;
+
+    class Group {
+    private:
+        __m128i mControl;
+
+    public:
+        explicit Group(const signed char* pos) :
+                mControl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+        BitMask match(signed char h2) const {
+            return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), mControl))));
+        }
+
+        BitMask matchEmpty() const {
+            return match(Empty);
+        }
+
+        BitMask matchEmptyOrDeleted() const {
+            return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(mControl)));
+        }
+
+        BitMask matchFull() const {
+            return BitMask(static_cast<uint16_t>(~_mm_movemask_epi8(mControl)));
+        }
+    };
+#else
+    static constexpr size_t Width = 8;
+    static constexpr size_t Shift = 3;
+
+    class Group {
+    private:
+        static constexpr uint64_t Lsbs = 0x0101010101010101;
+        static constexpr uint64_t Msbs = 0x8080808080808080;
+
+        uint64_t mControl;
+
+    public:
+        explicit Group(const signed char* pos) {
+            std::memcpy(&mControl, pos, sizeof(mControl));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            mControl = __builtin_bswap64(mControl);
+#endif
+        }
+
+        // May report false positives on full slots following a real match; callers compare keys anyway.
+        BitMask match(signed char h2) const {
+            uint64_t x = mControl ^ (Lsbs * static_cast<unsigned char>(h2));
+            return BitMask((x - Lsbs) & ~x & Msbs);
+        }
+
+        BitMask matchEmpty() const {
+            return BitMask(mControl & (~mControl << 6) & Msbs);
+        }
+
+        BitMask matchEmptyOrDeleted() const {
+            return BitMask(mControl & Msbs);
+        }
+
+        BitMask matchFull() const {
+            return BitMask(~mControl & Msbs);
+        }
+    };
+#endif
+
+    // Loads groups at triangular offsets from the first, Width * i * (i + 1) / 2 slots for the i-th, so that
+    // probes starting close together part ways instead of piling up into one long run. With a power-of-two
+    // capacity the first capacity / Width loads reach every group; other capacities continue linearly from
+    // the start after that many, so that every slot is still reached.
+    class Probe {
+    private:
+        size_t mStart;
+        size_t mPos;
+        size_t mLoads;
+        size_t mCapacity;
+        size_t mGroups;
+
+    public:
+        Probe(size_t start, size_t capacity) :
+                mStart(start),
+                mPos(start),
+                mLoads(0),
+                mCapacity(capacity),
+                mGroups((capacity + Width - 1) / Width) {}
+
+        // First slot of the group to load.
+        size_t pos() const {
+            return mPos;
+        }
+
+        // Groups loaded before this one.
+        size_t loads() const {
+            return mLoads;
+        }
+
+        // Every slot has been loaded once this group has.
+        bool last() const {
+            return mLoads + 1 >= 2 * mGroups;
+        }
+
+        // Whether the group loaded covers index.
+        bool covers(size_t index) const {
+            return (index + mCapacity - mPos) % mCapacity < Width;
+        }
+
+        void next() {
+            ++mLoads;
+            if (mLoads < mGroups) {
+                mPos = (mPos + Width * mLoads) % mCapacity;
+            } else {
+                mPos = (mStart + Width * (mLoads - mGroups)) % mCapacity;
+            }
+        }
+    };
+
+public:
+    template<typename Node, typename Allocator, typename Growth>
+    class Table {
+    private:
+        using StoredType = typename Node::value_type;
+        using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+        using NodeTraits = std::allocator_traits<NodeAllocator>;
+        using ControlAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<signed char>;
+        using IndexAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<size_t>;
+        using Hashes = std::vector<size_t, IndexAllocator>;
+
+        template<typename T>
+        class iterator_impl {
+            friend class Table;
+
+        private:
+            using NodePointer = std::conditional_t<std::is_const_v<T>, const Node*, Node*>;
+
+            const signed char* mControl;
+            const signed char* mControlEnd;
+            NodePointer mSlot;
+
+            iterator_impl(const signed char* control, const signed char* controlEnd, NodePointer slot) :
+                    mControl(control),
+                    mControlEnd(controlEnd),
+                    mSlot(slot) {
+                skipFree();
+            }
+
+            // Skips a whole group of free slots at a time; full slots among the mirrored bytes past the end
+            // only cut the skip short at the end.
+            void skipFree() {
+                while (mControl != mControlEnd) {
+                    BitMask full = Group(mControl).matchFull();
+                    size_t skip = std::min<size_t>(full ? full.lowest() : Width, mControlEnd - mControl);
+                    mControl += skip;
+                    mSlot += skip;
+                    if (full) {
+                        return;
+                    }
+                }
+            }
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = StoredType;
+            using difference_type = ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            iterator_impl() = default;
+
+            reference operator*() const {
+                return mSlot->value;
+            }
+
+            pointer operator->() const {
+                return &mSlot->value;
+            }
+
+            iterator_impl& operator++() {
+                ++mControl;
+                ++mSlot;
+                skipFree();
+                return *this;
+            }
+
+            iterator_impl operator++(int) {
+                iterator_impl old = *this;
+                ++*this;
+                return old;
+            }
+
+            friend bool operator==(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return lhs.mSlot == rhs.mSlot;
+            }
+
+            friend bool operator!=(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return !(lhs == rhs);
+            }
+        };
+
+        NodeAllocator mAllocator;
+        // Holds mCapacity + Width - 1 bytes: the first Width - 1 are mirrored at the end so that a group
+        // starting at any slot can be loaded without wrapping around.
+        std::vector<signed char, ControlAllocator> mControl;
+        Node* mSlots;
+        size_t mCapacity;
+        Growth mGrowth;
+        size_t mSize;
+        size_t mDeleted;
+
+        static signed char h2(size_t hash) {
+            return static_cast<signed char>(hash & 0x7F);
+        }
+
+        size_t start(size_t hash) const {
+            return mGrowth.index(hash >> 7);
+        }
+
+        size_t wrap(size_t index) const {
+            return index >= mCapacity ? index - mCapacity : index;
+        }
+
+        void setControl(size_t index, signed char control) {
+            mControl[index] = control;
+            if (index < Width - 1) {
+                mControl[mCapacity + index] = control;
+            }
+        }
+
+        void destroySlots() {
+            for (size_t i = 0; i != mCapacity; ++i) {
+                if (mControl[i] >= 0) {
+                    NodeTraits::destroy(mAllocator, mSlots + i);
+                }
+            }
+        }
+
+        // On a miss, sets *missLength to the groups loaded, as probe_length(hash) counts them.
+        template<typename Pred>
+        size_t findIndex(size_t hash, Pred pred, size_t* missLength = nullptr) const {
+            for (Probe probe(start(hash), mCapacity);; probe.next()) {
+                Group group(mControl.data() + probe.pos());
+                for (auto match = group.match(h2(hash)); match; match.removeLowest()) {
+                    size_t index = wrap(probe.pos() + match.lowest());
+                    if (mControl[index] >= 0 && mSlots[index].matches(hash, pred)) {
+                        return index;
+                    }
+                }
+                if (group.matchEmpty() || probe.last()) {
+                    if (missLength != nullptr) {
+                        *missLength = probe.loads() + 1;
+                    }
+                    return mCapacity;
+                }
+            }
+        }
+
+        iterator_impl<StoredType> at(size_t index) {
+            const signed char* controlEnd = mControl.data() + mCapacity;
+            return iterator_impl<StoredType>(mControl.data() + index, controlEnd, mSlots + index);
+        }
+
+        iterator_impl<const StoredType> at(size_t index) const {
+            const signed char* controlEnd = mControl.data() + mCapacity;
+            return iterator_impl<const StoredType>(mControl.data() + index, controlEnd, mSlots + index);
+        }
+
+        // The hashes of the entries in slot order.
+        template<typename HashOfNode>
+        Hashes hashes(HashOfNode hashOfNode) const {
+            Hashes hashes{IndexAllocator(mAllocator)};
+            hashes.reserve(mSize);
+            for (size_t i = 0; i != mCapacity; ++i) {
+                if (mControl[i] >= 0) {
+                    hashes.push_back(hashOfNode(mSlots[i]));
+                }
+            }
+            return hashes;
+        }
+
+        // Relocates the entries into a table of bucketCount slots, each under its hash from hashes.
+        void rebuild(size_t bucketCount, const Hashes& hashes) {
+            Table rebuilt(bucketCount, get_allocator());
+            auto hash = hashes.begin();
+            for (size_t i = 0; i != mCapacity; ++i) {
+                if (mControl[i] >= 0) {
+                    rebuilt.emplace(*hash++, relocated(mSlots[i].value));
+                }
+            }
+            swap(rebuilt);
+        }
+
+    public:
+        using iterator = iterator_impl<StoredType>;
+        using const_iterator = iterator_impl<const StoredType>;
+
+        static constexpr float DefaultMaxLoadFactor = 0.875f;
+        // Insertion needs a slot that is neither full nor deleted.
+        static constexpr float MaxLoadFactorLimit = 1.0f;
+        static constexpr bool KeepsInsertionOrder = false;
+        static constexpr bool SupportsParallel = false;
+
+        // In groups. Random keys reach about 2 / (1 - load) by 2^25 slots, a few more with each quadrupling,
+        // so twice that; a full table never reseeds. Deleted slots lengthen probes too, and the rehash of a
+        // reseed clears them.
+        static size_t reseed_threshold_for(float maxLoadFactor) {
+            return maxLoadFactor < 1 ? static_cast<size_t>(std::ceil(4 / (1 - maxLoadFactor))) : 0;
+        }
+
+        Table(size_t bucketCount, const Allocator& allocator) :
+                mAllocator(allocator),
+                mControl(ControlAllocator(allocator)),
+                mCapacity(Growth::round_up(std::max(bucketCount, Width))),
+                mGrowth(mCapacity),
+                mSize(0),
+                mDeleted(0) {
+            mControl.assign(mCapacity + Width - 1, Empty);
+            mSlots = NodeTraits::allocate(mAllocator, mCapacity);
+        }
+
+        Table(const Table& rhs, const Allocator& allocator) : Table(rhs.mCapacity, allocator) {
+            // A table without slots copies as a new one.
+            if (rhs.mCapacity == 0) {
+                return;
+            }
+            for (size_t i = 0; i != mCapacity; ++i) {
+                if (rhs.mControl[i] >= 0) {
+                    NodeTraits::construct(mAllocator, mSlots + i, rhs.mSlots[i]);
+                    mControl[i] = rhs.mControl[i];
+                }
+            }
+            mControl = rhs.mControl;
+            mSize = rhs.mSize;
+            mDeleted = rhs.mDeleted;
+        }
+
+        Table(Table&& rhs) noexcept :
+                mAllocator(rhs.mAllocator),
+                mControl(std::move(rhs.mControl)),
+                mSlots(std::exchange(rhs.mSlots, nullptr)),
+                mCapacity(std::exchange(rhs.mCapacity, 0)),
+                mGrowth(rhs.mGrowth),
+                mSize(std::exchange(rhs.mSize, 0)),
+                mDeleted(std::exchange(rhs.mDeleted, 0)) {}
+
+        Table& operator=(const Table&) = delete;
+
+        ~Table() {
+            if (mSlots != nullptr) {
+                destroySlots();
+                NodeTraits::deallocate(mAllocator, mSlots, mCapacity);
+            }
+        }
+
+        Allocator get_allocator() const {
+            return Allocator(mAllocator);
+        }
+
+        size_t size() const {
+            return mSize;
+        }
+
+        size_t occupied() const {
+            return mSize + mDeleted;
+        }
+
+        size_t bucket_count() const {
+            return mCapacity;
+        }
+
+        void prefetch(size_t hash) const {
+            size_t pos = start(hash);
+            prefetchRead(mControl.data() + pos);
+            prefetchRead(mSlots + pos);
+        }
+
+        size_t bucket_of(size_t hash) const {
+            return start(hash);
+        }
+
+        // Calls fn with the number of groups a lookup of every entry loads.
+        template<typename HashOf, typename Fn>
+        void for_each_probe_length(HashOf hashOf, Fn fn) const {
+            for (size_t i = 0; i != mCapacity; ++i) {
+                if (mControl[i] >= 0) {
+                    Probe probe(start(mSlots[i].hash(hashOf)), mCapacity);
+                    while (!probe.covers(i)) {
+                        probe.next();
+                    }
+                    fn(probe.loads() + 1);
+                }
+            }
+        }
+
+        // Groups a lookup that misses at hash loads.
+        size_t probe_length(size_t hash) const {
+            Probe probe(start(hash), mCapacity);
+            while (!probe.last() && !Group(mControl.data() + probe.pos()).matchEmpty()) {
+                probe.next();
+            }
+            return probe.loads() + 1;
+        }
+
+        // Entries are relocated into a new table under their new hashes; stored hashes are never overwritten.
+        template<typename HashOf>
+        void relink(HashOf hashOf) {
+            rebuild(mCapacity, hashes([&](const Node& node) {
+                return hashOf(node.value);
+            }));
+        }
+
+        // The slots are the buckets; they count as entries.
+        HashMapMemoryUsage memory_usage() const {
+            HashMapMemoryUsage usage;
+            usage.entries = mCapacity * sizeof(Node);
+            usage.metadata = mControl.capacity();
+            usage.allocator_slack = allocationSlack(usage.entries) + allocationSlack(usage.metadata);
+            return usage;
+        }
+
+        iterator begin() {
+            return at(0);
+        }
+
+        iterator end() {
+            return at(mCapacity);
+        }
+
+        const_iterator begin() const {
+            return at(0);
+        }
+
+        const_iterator end() const {
+            return at(mCapacity);
+        }
+
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred) {
+            return at(findIndex(hash, pred));
+        }
+
+        template<typename Pred>
+        const_iterator find(size_t hash, Pred pred) const {
+            return at(findIndex(hash, pred));
+        }
+
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred, size_t& missLength) {
+            return at(findIndex(hash, pred, &missLength));
+        }
+
+        template<typename... Args>
+        iterator emplace(size_t hash, Args&&... args) {
+            Probe probe(start(hash), mCapacity);
+            auto free = Group(mControl.data() + probe.pos()).matchEmptyOrDeleted();
+            while (!free) {
+                probe.next();
+                free = Group(mControl.data() + probe.pos()).matchEmptyOrDeleted();
+            }
+            size_t index = wrap(probe.pos() + free.lowest());
+            NodeTraits::construct(mAllocator, mSlots + index, hash, std::forward<Args>(args)...);
+            if (mControl[index] == Deleted) {
+                --mDeleted;
+            }
+            setControl(index, h2(hash));
+            ++mSize;
+            return at(index);
+        }
+
+        void erase(iterator pos) {
+            size_t index = pos.mSlot - mSlots;
+            NodeTraits::destroy(mAllocator, mSlots + index);
+            // If every window of Width slots covering this one has an empty slot, no probe sequence
+            // ever found it inside a full group, so it can become empty again instead of a tombstone.
+            auto emptyAfter = Group(mControl.data() + index).matchEmpty();
+            auto emptyBefore = Group(mControl.data() + wrap(index + mCapacity - Width)).matchEmpty();
+            if (emptyAfter && emptyBefore && emptyAfter.lowest() + emptyBefore.highestFromTop() < Width) {
+                setControl(index, Empty);
+            } else {
+                setControl(index, Deleted);
+                ++mDeleted;
+            }
+            --mSize;
+        }
+
+        static size_t bucket_count_for(size_t bucketCount) {
+            return Growth::round_up(std::max(bucketCount, Width));
+        }
+
+        // The slots are the entries, sized by rehash.
+        void reserve(size_t) {}
+
+        // Hashes every entry before relocating any, so that a Hash that throws leaves the table as it was.
+        // Entries are moved into the new table, keys included, unless that may throw; then they are copied,
+        // and the old slots are only destroyed once the new table is complete.
+        template<typename HashOf>
+        void rehash(size_t bucketCount, HashOf hashOf) {
+            rebuild(bucketCount, hashes([&](const Node& node) {
+                return node.hash(hashOf);
+            }));
+        }
+
+        void clear() {
+            destroySlots();
+            std::fill(mControl.begin(), mControl.end(), Empty);
+            mSize = 0;
+            mDeleted = 0;
+        }
+
+        void swap(Table& rhs) noexcept {
+            if constexpr (NodeTraits::propagate_on_container_swap::value) {
+                std::swap(mAllocator, rhs.mAllocator);
+            }
+            mControl.swap(rhs.mControl);
+            std::swap(mSlots, rhs.mSlots);
+            std::swap(mCapacity, rhs.mCapacity);
+            std::swap(mGrowth, rhs.mGrowth);
+            std::swap(mSize, rhs.mSize);
+            std::swap(mDeleted, rhs.mDeleted);
+        }
+    };
+};
+
+// Entries sit contiguously in insertion order and the hash table only holds their positions, probed
+// linearly. Erasing leaves a hole in the entries, which are compacted once holes outnumber them. Like
+// FlatStorage, growth moves the entries, so references to them do not survive insertions.
+struct OrderedStorage {
+    template<typename Node, typename Allocator, typename Growth>
+    class Table {
+    private:
+        using StoredType = typename Node::value_type;
+        // Entries keep their hash: compaction and rehashing then never call Hash.
+        using Entry = std::optional<HashNode<StoredType, true>>;
+        using EntryAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+
+        struct Bucket {
+            uint32_t entry;
+            // The low bits of the hash, to skip most mismatching entries without touching them.
+            uint32_t hash;
+        };
+
+        using BucketAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Bucket>;
+        using IndexAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<size_t>;
+
+        static constexpr uint32_t Empty = std::numeric_limits<uint32_t>::max();
+
+        template<typename T>
+        class iterator_impl {
+            friend class Table;
+
+        private:
+            using EntryPointer = std::conditional_t<std::is_const_v<T>, const Entry*, Entry*>;
+
+            EntryPointer mEntry;
+            EntryPointer mEntryEnd;
+
+            iterator_impl(EntryPointer entry, EntryPointer entryEnd) : mEntry(entry), mEntryEnd(entryEnd) {
+                skipHoles();
+            }
+
+            void skipHoles() {
+                while (mEntry != mEntryEnd && !mEntry->has_value()) {
+                    ++mEntry;
+                }
+            }
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = StoredType;
+            using difference_type = ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            iterator_impl() = default;
+
+            reference operator*() const {
+                return (*mEntry)->value;
+            }
+
+            pointer operator->() const {
+                return &(*mEntry)->value;
+            }
+
+            iterator_impl& operator++() {
+                ++mEntry;
+                skipHoles();
+                return *this;
+            }
+
+            iterator_impl operator++(int) {
+                iterator_impl old = *this;
+                ++*this;
+                return old;
+            }
+
+            friend bool operator==(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return lhs.mEntry == rhs.mEntry;
+            }
+
+            friend bool operator!=(const iterator_impl& lhs, const iterator_impl& rhs) {
+                return !(lhs == rhs);
+            }
+        };
+
+        std::vector<Entry, EntryAllocator> mEntries;
+        std::vector<Bucket, BucketAllocator> mBuckets;
+        Growth mGrowth;
+        size_t mSize;
+
+        size_t wrap(size_t index) const {
+            return index == mBuckets.size() ? 0 : index;
+        }
+
+        // On a miss, sets *missLength to the buckets inspected, as probe_length(hash) counts them.
+        template<typename Pred>
+        size_t findBucket(size_t hash, Pred& pred, size_t* missLength = nullptr) const {
+            size_t pos = mGrowth.index(hash);
+            size_t probed = 0;
+            for (; probed != mBuckets.size(); ++probed, pos = wrap(pos + 1)) {
+                const Bucket& bucket = mBuckets[pos];
+                if (bucket.entry == Empty) {
+                    break;
+                }
+                if (bucket.hash == static_cast<uint32_t>(hash) && mEntries[bucket.entry]->matches(hash, pred)) {
+                    return pos;
+                }
+            }
+            if (missLength != nullptr) {
+                *missLength = std::min(probed + 1, mBuckets.size());
+            }
+            return mBuckets.size();
+        }
+
+        void link(size_t entry) {
+            size_t hash = mEntries[entry]->storedHash;
+            size_t pos = mGrowth.index(hash);
+            while (mBuckets[pos].entry != Empty) {
+                pos = wrap(pos + 1);
+            }
+            mBuckets[pos] = Bucket{static_cast<uint32_t>(entry), static_cast<uint32_t>(hash)};
+        }
+
+        // Shifts the rest of the probe run back over the freed bucket, so that lookups need no tombstones.
+        void unlink(size_t pos) {
+            size_t capacity = mBuckets.size();
+            size_t hole = pos;
+            size_t next = wrap(pos + 1);
+            for (size_t probed = 1; probed != capacity && mBuckets[next].entry != Empty; ++probed) {
+                size_t home = mGrowth.index(mEntries[mBuckets[next].entry]->storedHash);
+                if ((next + capacity - home) % capacity >= (next + capacity - hole) % capacity) {
+                    mBuckets[hole] = mBuckets[next];
+                    hole = next;
+                }
+                next = wrap(next + 1);
+            }
+            mBuckets[hole].entry = Empty;
+        }
+
+        void relinkAll() {
+            std::fill(mBuckets.begin(), mBuckets.end(), Bucket{Empty, 0});
+            for (size_t i = 0; i != mEntries.size(); ++i) {
+                if (mEntries[i].has_value()) {
+                    link(i);
+                }
+            }
+        }
+
+        // Moves the entries over the holes, keeping their order, and leaves the index to the caller. Entries
+        // are only copied when moving them may throw; if a copy does, every entry is still held exactly once
+        // and the index is rebuilt for where they are.
+        void compactEntries() {
+            size_t live = 0;
+            try {
+                for (size_t i = 0; i != mEntries.size(); ++i) {
+                    if (mEntries[i].has_value()) {
+                        if (live != i) {
+                            mEntries[live].emplace(mEntries[i]->storedHash, relocated(mEntries[i]->value));
+                            mEntries[i].reset();
+                        }
+                        ++live;
+                    }
+                }
+            } catch (...) {
+                relinkAll();
+                throw;
+            }
+            while (mEntries.size() != live) {
+                mEntries.pop_back();
+            }
+        }
+
+        void compact() {
+            compactEntries();
+            relinkAll();
+        }
+
+        iterator_impl<StoredType> at(size_t entry) {
+            Entry* entries = mEntries.data();
+            return iterator_impl<StoredType>(entries + entry, entries + mEntries.size());
+        }
+
+        iterator_impl<const StoredType> at(size_t entry) const {
+            const Entry* entries = mEntries.data();
+            return iterator_impl<const StoredType>(entries + entry, entries + mEntries.size());
+        }
+
+    public:
+        using iterator = iterator_impl<StoredType>;
+        using const_iterator = iterator_impl<const StoredType>;
+
+        static constexpr float DefaultMaxLoadFactor = 0.75f;
+        // A lookup for a missing key stops at the first empty bucket.
+        static constexpr float MaxLoadFactorLimit = 1.0f;
+        static constexpr bool KeepsInsertionOrder = true;
+        static constexpr bool SupportsParallel = false;
+
+        // Linear probing clusters: random keys reach about 16 / (1 - load)^2 by 2^25 buckets, so twice that;
+        // a full table never reseeds.
+        static size_t reseed_threshold_for(float maxLoadFactor) {
+            double free = 1 - static_cast<double>(maxLoadFactor);
+            return free > 0 ? static_cast<size_t>(std::ceil(32 / (free * free))) : 0;
+        }
+
+        Table(size_t bucketCount, const Allocator& allocator) :
+                mEntries(EntryAllocator(allocator)),
+                mBuckets(Growth::round_up(bucketCount), Bucket{Empty, 0}, BucketAllocator(allocator)),
+                mGrowth(mBuckets.size()),
+                mSize(0) {}
+
+        Table(const Table& rhs, const Allocator& allocator) : Table(rhs.mBuckets.size(), allocator) {
+            mEntries.reserve(rhs.mSize);
+            for (const Entry& entry : rhs.mEntries) {
+                if (entry.has_value()) {
+                    mEntries.push_back(entry);
+                }
+            }
+            mSize = rhs.mSize;
+            relinkAll();
+        }
 
-    template<typename BIter, typename SIter>
-    class iterator_impl {
-        friend class HashMap;
+        Table(Table&& rhs) noexcept :
+                mEntries(std::move(rhs.mEntries)),
+                mBuckets(std::move(rhs.mBuckets)),
+                mGrowth(rhs.mGrowth),
+                mSize(std::exchange(rhs.mSize, 0)) {}
 
-    private:
-        BIter mBucket;
-        BIter mBucketEnd;
-        SIter mStored;
+        Allocator get_allocator() const {
+            return Allocator(mEntries.get_allocator());
+        }
+
+        size_t size() const {
+            return mSize;
+        }
+
+        size_t occupied() const {
+            return mSize;
+        }
+
+        size_t bucket_count() const {
+            return mBuckets.size();
+        }
+
+        void prefetch(size_t hash) const {
+            prefetchRead(&mBuckets[mGrowth.index(hash)]);
+        }
+
+        size_t bucket_of(size_t hash) const {
+            return mGrowth.index(hash);
+        }
 
-        explicit iterator_impl(BIter bucket,
-                               BIter bucketEnd,
-                               SIter stored = SIter()) :
-                mBucket(bucket),
-                mBucketEnd(bucketEnd),
-                mStored(stored) {
-            while (mStored == mBucket->end()) {
-                if (++mBucket == mBucketEnd) {
-                    mStored = SIter();
-                    return;
+        // Calls fn with the number of buckets a lookup of every entry inspects.
+        template<typename HashOf, typename Fn>
+        void for_each_probe_length(HashOf, Fn fn) const {
+            size_t capacity = mBuckets.size();
+            for (size_t i = 0; i != capacity; ++i) {
+                if (mBuckets[i].entry != Empty) {
+                    size_t home = mGrowth.index(mEntries[mBuckets[i].entry]->storedHash);
+                    fn((i + capacity - home) % capacity + 1);
                 }
-                mStored = mBucket->begin();
             }
         }
 
-    public:
-        using iterator_category = std::forward_iterator_tag;
-        using value_type = typename SIter::value_type;
-        using difference_type = ptrdiff_t;
-        using pointer = typename SIter::pointer;
-        using reference = typename SIter::reference;
+        // Buckets a lookup that misses at hash inspects, the empty one it stops at included.
+        size_t probe_length(size_t hash) const {
+            size_t pos = mGrowth.index(hash);
+            size_t length = 1;
+            for (; length < mBuckets.size() && mBuckets[pos].entry != Empty; ++length) {
+                pos = wrap(pos + 1);
+            }
+            return length;
+        }
 
-        iterator_impl() = default;
+        // Stored hashes are only overwritten once every new one has been computed; the entries stay where
+        // they are, holes included.
+        template<typename HashOf>
+        void relink(HashOf hashOf) {
+            std::vector<size_t, IndexAllocator> hashes(IndexAllocator(mEntries.get_allocator()));
+            hashes.reserve(mSize);
+            for (const Entry& entry : mEntries) {
+                if (entry.has_value()) {
+                    hashes.push_back(hashOf(entry->value));
+                }
+            }
+            auto hash = hashes.begin();
+            for (Entry& entry : mEntries) {
+                if (entry.has_value()) {
+                    entry->storedHash = *hash++;
+                }
+            }
+            relinkAll();
+        }
 
-        reference operator*() const {
-            return *mStored;
+        // Erased entries count until the next compaction.
+        HashMapMemoryUsage memory_usage() const {
+            HashMapMemoryUsage usage;
+            usage.buckets = mBuckets.capacity() * sizeof(Bucket);
+            usage.entries = mEntries.capacity() * sizeof(Entry);
+            usage.allocator_slack = allocationSlack(usage.buckets) + allocationSlack(usage.entries);
+            return usage;
         }
 
-        pointer const operator->() const {
-            return mStored.operator->();
+        iterator begin() {
+            return at(0);
         }
 
-        iterator_impl& operator++() {
-            ++mStored;
-            while (mStored == mBucket->end()) {
-                if (++mBucket == mBucketEnd) {
-                    mStored = StoredIterator();
-                    return *this;
-                }
-                mStored = mBucket->begin();
+        iterator end() {
+            return at(mEntries.size());
+        }
+
+        const_iterator begin() const {
+            return at(0);
+        }
+
+        const_iterator end() const {
+            return at(mEntries.size());
+        }
+
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred) {
+            size_t pos = findBucket(hash, pred);
+            return pos == mBuckets.size() ? end() : at(mBuckets[pos].entry);
+        }
+
+        template<typename Pred>
+        const_iterator find(size_t hash, Pred pred) const {
+            size_t pos = findBucket(hash, pred);
+            return pos == mBuckets.size() ? end() : at(mBuckets[pos].entry);
+        }
+
+        template<typename Pred>
+        iterator find(size_t hash, Pred pred, size_t& missLength) {
+            size_t pos = findBucket(hash, pred, &missLength);
+            return pos == mBuckets.size() ? end() : at(mBuckets[pos].entry);
+        }
+
+        template<typename... Args>
+        iterator emplace(size_t hash, Args&&... args) {
+            if (mEntries.size() == Empty) {
+                throw std::length_error("OrderedStorage: too many entries");
+            }
+            mEntries.emplace_back(std::in_place, hash, std::forward<Args>(args)...);
+            link(mEntries.size() - 1);
+            ++mSize;
+            return at(mEntries.size() - 1);
+        }
+
+        void erase(iterator pos) {
+            size_t entry = pos.mEntry - mEntries.data();
+            auto isEntry = [&](const StoredType& stored) {
+                return &stored == &(*pos.mEntry)->value;
+            };
+            unlink(findBucket((*pos.mEntry)->storedHash, isEntry));
+            mEntries[entry].reset();
+            --mSize;
+            while (!mEntries.empty() && !mEntries.back().has_value()) {
+                mEntries.pop_back();
+            }
+            if (mEntries.size() - mSize > mSize) {
+                compact();
             }
-            return *this;
         }
 
-        iterator_impl operator++(int) {
-            iterator_impl old = *this;
-            ++*this;
-            return old;
+        static size_t bucket_count_for(size_t bucketCount) {
+            return Growth::round_up(bucketCount);
         }
 
-        friend bool operator==(const iterator_impl& lhs, const iterator_impl& rhs) {
-            return lhs.mBucket == rhs.mBucket && lhs.mStored == rhs.mStored;
+        // The entries are kept apart from the buckets. Their key is const, so each regrowth of the vector
+        // copies every one of them.
+        void reserve(size_t count) {
+            mEntries.reserve(count);
         }
 
-        friend bool operator!=(const iterator_impl& lhs, const iterator_impl& rhs) {
-            return !(lhs == rhs);
+        // The new index is only built once compaction has succeeded.
+        template<typename HashOf>
+        void rehash(size_t bucketCount, HashOf) {
+            std::vector<Bucket, BucketAllocator> buckets(Growth::round_up(bucketCount), Bucket{Empty, 0},
+                                                         mBuckets.get_allocator());
+            if (mEntries.size() != mSize) {
+                compactEntries();
+            }
+            mBuckets.swap(buckets);
+            mGrowth = Growth(mBuckets.size());
+            relinkAll();
+        }
+
+        void clear() {
+            mEntries.clear();
+            std::fill(mBuckets.begin(), mBuckets.end(), Bucket{Empty, 0});
+            mSize = 0;
+        }
+
+        void swap(Table& rhs) noexcept {
+            mEntries.swap(rhs.mEntries);
+            mBuckets.swap(rhs.mBuckets);
+            std::swap(mGrowth, rhs.mGrowth);
+            std::swap(mSize, rhs.mSize);
         }
     };
+};
+
+
+// What HashMap::stats() reports. The counters stay zero unless the map counts them with CountingStats.
+struct HashMapStats {
+    size_t size = 0;
+    size_t bucket_count = 0;
+    float load_factor = 0;
+
+    // find, at and the batch lookups; the probes of insertions and erasures are not lookups.
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // KeyEqual calls made by lookups, insertions and erasures; close to one per hit when the hash spreads keys well.
+    uint64_t key_comparisons = 0;
+    // Entries actually added: an insertion of a present key or one that throws is not counted.
+    uint64_t insertions = 0;
+    uint64_t erasures = 0;
+    uint64_t rehashes = 0;
+    std::chrono::nanoseconds rehash_time{0};
+    // Heap memory held by the table, as HashMapMemoryUsage::allocated().
+    size_t bytes_allocated = 0;
+
+    // Chain positions or probe distances of the entries, as the storage defines them: entry k of
+    // probe_length_histogram counts the entries a lookup reaches at probe length k + 1.
+    double average_probe_length = 0;
+    size_t max_probe_length = 0;
+    std::vector<size_t> probe_length_histogram;
+};
+
+// The default Stats policy: every hook compiles away. HashMap holds its policy as a private base, so that an
+// empty one takes no space, and calls the hooks from const lookups too, so they are const.
+struct NoStats {
+    static constexpr bool Enabled = false;
+
+    void lookedUp(bool) const {}
+
+    void compared() const {}
+
+    void inserted(size_t = 1) const {}
+
+    void erased() const {}
+
+    void rehashed(std::chrono::nanoseconds) const {}
+
+    void report(HashMapStats&) const {}
+};
+
+// Counts operations with relaxed atomics, so that lookups through a const map may run concurrently. The
+// counters describe the map they live in: copies and moved-to maps start from zero.
+class CountingStats {
+private:
+    // A lookup is either a hit or a miss and lookups are their sum: misses derived from a separate lookup
+    // count would wrap whenever another thread's hit landed between the two loads.
+    mutable std::atomic<uint64_t> mHits{0};
+    mutable std::atomic<uint64_t> mMisses{0};
+    mutable std::atomic<uint64_t> mComparisons{0};
+    mutable std::atomic<uint64_t> mInsertions{0};
+    mutable std::atomic<uint64_t> mErasures{0};
+    mutable std::atomic<uint64_t> mRehashes{0};
+    mutable std::atomic<int64_t> mRehashNanoseconds{0};
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+public:
+    static constexpr bool Enabled = true;
+
+    CountingStats() = default;
+
+    CountingStats(const CountingStats&) {}
+
+    CountingStats& operator=(const CountingStats&) {
+        return *this;
+    }
+
+    void lookedUp(bool hit) const {
+        add(hit ? mHits : mMisses);
+    }
+
+    void compared() const {
+        add(mComparisons);
+    }
+
+    void inserted(size_t count = 1) const {
+        add(mInsertions, count);
+    }
+
+    void erased() const {
+        add(mErasures);
+    }
+
+    void rehashed(std::chrono::nanoseconds time) const {
+        add(mRehashes);
+        mRehashNanoseconds.fetch_add(time.count(), std::memory_order_relaxed);
+    }
 
-    static constexpr double maxLoadFactor = 0.5;
+    void report(HashMapStats& stats) const {
+        stats.hits = mHits.load(std::memory_order_relaxed);
+        stats.misses = mMisses.load(std::memory_order_relaxed);
+        stats.lookups = stats.hits + stats.misses;
+        stats.key_comparisons = mComparisons.load(std::memory_order_relaxed);
+        stats.insertions = mInsertions.load(std::memory_order_relaxed);
+        stats.erasures = mErasures.load(std::memory_order_relaxed);
+        stats.rehashes = mRehashes.load(std::memory_order_relaxed);
+        stats.rehash_time = std::chrono::nanoseconds(mRehashNanoseconds.load(std::memory_order_relaxed));
+    }
+};
+
+template<typename, typename, typename, typename, typename, typename, typename>
+class ConcurrentHashMap;
+
+template<typename Key,
+         typename Value,
+         typename Hash = std::hash<Key>,
+         typename KeyEqual = std::equal_to<Key>,
+         typename Allocator = std::allocator<std::pair<const Key, Value>>,
+         typename Storage = ChainedStorage,
+         typename Growth = PowerOfTwoGrowth,
+         typename Stats = NoStats>
+class HashMap : private Stats {
+private:
+    // Hashes each key once and hands it to the shard through the *Hashed entry points below.
+    template<typename, typename, typename, typename, typename, typename, typename>
+    friend class ConcurrentHashMap;
+
+    using StoredType = std::pair<const Key, Value>;
+    using Node = HashNode<StoredType, StoreHash<Key>::value>;
+    using Table = typename Storage::template Table<Node, Allocator, Growth>;
 
 
-    std::vector<Bucket> mData;
+    Table mTable;
     Hash mHash;
-    size_t mSize;
+    KeyEqual mKeyEqual;
+    float mMaxLoadFactor;
+    float mMinLoadFactor;
+    size_t mSeed;
+    size_t mReseedThreshold;
+    // No automatic reseed until the map holds this many entries.
+    size_t mReseedFloor;
 
 private:
-    double loadFactor() const {
-        return mSize / mData.size();
-    }
-
-    void rehash() {
-        size_t oldSize = mData.size();
-        mData.resize(oldSize * 2);
-        for (size_t i = 0; i != oldSize; ++i) {
-            for (auto it = mData[i].begin(); it != mData[i].end();) {
-                size_t newIndex = indexOf(it->first);
-                if (newIndex != i) {
-                    mData[newIndex].push_back(*it);
-                    it = mData[i].erase(it);
-                } else {
-                    ++it;
-                }
+    const Stats& counters() const {
+        return *this;
+    }
+
+    // Computed in double: float loses precision past 2^24 entries.
+    size_t bucketsFor(size_t count) const {
+        return static_cast<size_t>(std::ceil(static_cast<double>(count) / mMaxLoadFactor));
+    }
+
+    double maxOccupied() const {
+        return static_cast<double>(mMaxLoadFactor) * bucket_count();
+    }
+
+    // noexcept when Hash is, which lets the tables skip what they do to survive a throwing Hash.
+    auto hashOfStored() const {
+        return [this](const StoredType& stored) noexcept(noexcept(hashOf(stored.first))) {
+            return hashOf(stored.first);
+        };
+    }
+
+    template<typename Fn>
+    void timeRehash(Fn rehash) {
+        auto start = std::chrono::steady_clock::time_point();
+        if constexpr (Stats::Enabled) {
+            start = std::chrono::steady_clock::now();
+        }
+        rehash();
+        if constexpr (Stats::Enabled) {
+            counters().rehashed(std::chrono::steady_clock::now() - start);
+        }
+    }
+
+    void rehashTable(size_t bucketCount, size_t threads = 1) {
+        timeRehash([&] {
+            if constexpr (Table::SupportsParallel) {
+                mTable.rehash(bucketCount, hashOfStored(), threads);
+            } else {
+                mTable.rehash(bucketCount, hashOfStored());
+            }
+        });
+    }
+
+    // Deleted slots count towards the load too; when they make up most of it, rebuilding in place is enough.
+    // Returns whether the table was rebuilt.
+    bool reserveForInsert() {
+        if (mTable.occupied() + 1 <= maxOccupied()) {
+            return false;
+        }
+        if (size() + 1 <= maxOccupied() / 2) {
+            rehashTable(bucket_count());
+        } else {
+            rehash(std::max(bucket_count() * 2, bucketsFor(size() + 1)));
+        }
+        return true;
+    }
+
+    // Shrinks to half the maximum load, so that neither threshold is within reach right after.
+    void shrinkIfSparse() {
+        if (size() < static_cast<double>(mMinLoadFactor) * bucket_count()) {
+            rehash(bucketsFor(size() * 2));
+        }
+    }
+
+    template<typename K>
+    using EnableIfTransparent =
+            std::enable_if_t<IsTransparent<Hash>::value && IsTransparent<KeyEqual>::value && !std::is_same_v<K, Key>>;
+
+    template<typename K>
+    size_t hashOf(const K& key) const noexcept(std::is_nothrow_invocable_v<const Hash&, const K&>) {
+        return seededHash(mHash, key, mSeed);
+    }
+
+    // hashOf(key) for a Hash that returned hash for key.
+    size_t hashOfHashed(size_t hash) const {
+        return mixHash(hash ^ mSeed);
+    }
+
+    // Reseeds at most once per doubling of the map, so that keys a new seed cannot separate, which share
+    // their whole hash, cost an amortized constant rather than a rehash per insertion. probeLength comes from
+    // the insertion's own probe: every storage's find(hash, pred, missLength) reports on a miss what
+    // probe_length(hash) would measure, in that storage's units.
+    bool probeTooLong(size_t probeLength) const {
+        return mReseedThreshold != 0 && size() >= mReseedFloor && probeLength > mReseedThreshold;
+    }
+
+    template<typename K>
+    auto keyEquals(const K& key) const {
+        return [this, &key](const StoredType& stored) {
+            counters().compared();
+            return mKeyEqual(stored.first, key);
+        };
+    }
+
+    // An empty map is not searched: a moved-from one has no buckets to search.
+    template<typename K>
+    typename Table::iterator findKey(const K& key) {
+        return findKey(key, hashOf(key));
+    }
+
+    template<typename K>
+    typename Table::iterator findKey(const K& key, size_t hash) {
+        auto it = empty() ? mTable.end() : mTable.find(hash, keyEquals(key));
+        counters().lookedUp(it != mTable.end());
+        return it;
+    }
+
+    template<typename K>
+    typename Table::const_iterator findKey(const K& key) const {
+        return findKey(key, hashOf(key));
+    }
+
+    template<typename K>
+    typename Table::const_iterator findKey(const K& key, size_t hash) const {
+        auto it = empty() ? mTable.end() : mTable.find(hash, keyEquals(key));
+        counters().lookedUp(it != mTable.end());
+        return it;
+    }
+
+    // Nothing is constructed unless the key is missing.
+    template<typename K, typename... Args>
+    std::pair<typename Table::iterator, bool> emplaceUnique(K&& key, Args&&... args) {
+        return emplaceWithHash(hashOf(key), std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename... Args>
+    std::pair<typename Table::iterator, bool> emplaceWithHash(size_t hash, K&& key, Args&&... args) {
+        size_t probeLength = 0;
+        auto it = empty() ? mTable.end() : mTable.find(hash, keyEquals(key), probeLength);
+        if (it != mTable.end()) {
+            return {it, false};
+        }
+        // The miss measured the probe, unless the table has been rebuilt since; that happens once per growth.
+        if (reserveForInsert()) {
+            probeLength = mTable.probe_length(hash);
+        }
+        if (probeTooLong(probeLength)) {
+            reseed(randomSeed());
+            mReseedFloor = size() * 2;
+            hash = hashOf(key);
+        }
+        it = mTable.emplace(hash,
+                            std::piecewise_construct,
+                            std::forward_as_tuple(std::forward<K>(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+        counters().inserted();
+        return {it, true};
+    }
+
+    // Hashes a block of keys and prefetches their buckets before looking any of them up, so that the cache
+    // misses within a block overlap instead of being taken one after another.
+    template<typename Self, typename KeyIter, typename Fn>
+    static void forEachLookup(Self& self, KeyIter first, KeyIter last, Fn fn) {
+        constexpr size_t BlockSize = 16;
+        size_t hashes[BlockSize];
+        if (self.empty()) {
+            for (; first != last; ++first) {
+                self.counters().lookedUp(false);
+                fn(self.mTable.end());
             }
+            return;
         }
+        while (first != last) {
+            KeyIter block = first;
+            size_t count = 0;
+            for (; count != BlockSize && first != last; ++count, ++first) {
+                hashes[count] = self.hashOf(*first);
+                self.mTable.prefetch(hashes[count]);
+            }
+            for (size_t i = 0; i != count; ++i, ++block) {
+                auto it = self.mTable.find(hashes[i], self.keyEquals(*block));
+                self.counters().lookedUp(it != self.mTable.end());
+                fn(it);
+            }
+        }
+    }
+
+    template<typename K>
+    void eraseKey(const K& key, size_t hash) {
+        if (empty()) {
+            return;
+        }
+        auto it = mTable.find(hash, keyEquals(key));
+        if (it != mTable.end()) {
+            mTable.erase(it);
+            counters().erased();
+            shrinkIfSparse();
+        }
+    }
+
+    typename Table::iterator findHashed(const Key& key, size_t hash) {
+        return findKey(key, hashOfHashed(hash));
+    }
+
+    typename Table::const_iterator findHashed(const Key& key, size_t hash) const {
+        return findKey(key, hashOfHashed(hash));
+    }
+
+    template<typename K, typename... Args>
+    std::pair<typename Table::iterator, bool> emplaceHashed(size_t hash, K&& key, Args&&... args) {
+        return emplaceWithHash(hashOfHashed(hash), std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    void eraseHashed(const Key& key, size_t hash) {
+        eraseKey(key, hashOfHashed(hash));
     }
 
-    size_t indexOf(const Key& key) const {
-        return mHash(key) % mData.size();
+    // Stable counting sort into slices of the bucket array, so that placing the entries in this order keeps
+    // each stretch of insertions within a small part of the table.
+    template<typename Hashed>
+    void partitionByBucket(std::vector<Hashed>& hashed) const {
+        size_t partitions = std::min<size_t>(256, bucket_count());
+        auto partitionOf = [&](size_t hash) {
+            return mTable.bucket_of(hash) * partitions / bucket_count();
+        };
+        std::vector<size_t> starts(partitions + 1);
+        for (const Hashed& entry : hashed) {
+            ++starts[partitionOf(entry.first) + 1];
+        }
+        std::partial_sum(starts.begin(), starts.end(), starts.begin());
+        std::vector<Hashed> sorted(hashed.size());
+        for (const Hashed& entry : hashed) {
+            sorted[starts[partitionOf(entry.first)]++] = entry;
+        }
+        hashed.swap(sorted);
     }
 
 public:
-    using iterator = iterator_impl<BucketIterator, StoredIterator>;
-    using const_iterator = iterator_impl<BucketConstIterator, StoredConstIterator>;
+    using iterator = typename Table::iterator;
+    using const_iterator = typename Table::const_iterator;
+
+    using allocator_type = Allocator;
+
+    explicit HashMap(Hash hash = Hash(), KeyEqual keyEqual = KeyEqual(), const Allocator& allocator = Allocator()) :
+            HashMap(1, hash, keyEqual, allocator) {}
+
+    explicit HashMap(const Allocator& allocator) : HashMap(Hash(), KeyEqual(), allocator) {}
 
-    explicit HashMap(Hash hash = Hash()) : mData(1), mHash(hash), mSize(0) {}
+    explicit HashMap(size_t bucketCount,
+                     Hash hash = Hash(),
+                     KeyEqual keyEqual = KeyEqual(),
+                     const Allocator& allocator = Allocator()) :
+            mTable(std::max<size_t>(bucketCount, 1), allocator),
+            mHash(hash),
+            mKeyEqual(keyEqual),
+            mMaxLoadFactor(Table::DefaultMaxLoadFactor),
+            mMinLoadFactor(0),
+            mSeed(randomSeed()),
+            mReseedThreshold(Table::reseed_threshold_for(Table::DefaultMaxLoadFactor)),
+            mReseedFloor(0) {}
 
-    HashMap(const HashMap& rhs) : mData(rhs.mData), mHash(rhs.mHash), mSize(rhs.mSize) {}
+    HashMap(const HashMap& rhs) :
+            HashMap(rhs, std::allocator_traits<Allocator>::select_on_container_copy_construction(
+                    rhs.get_allocator())) {}
 
-    HashMap(HashMap&& rhs) noexcept :
-            mData(std::move(rhs.mData)),
-            mHash(std::move(rhs.mHash)),
-            mSize(rhs.mSize) {}
+    HashMap(const HashMap& rhs, const Allocator& allocator) :
+            mTable(rhs.mTable, allocator),
+            mHash(rhs.mHash),
+            mKeyEqual(rhs.mKeyEqual),
+            mMaxLoadFactor(rhs.mMaxLoadFactor),
+            mMinLoadFactor(rhs.mMinLoadFactor),
+            mSeed(rhs.mSeed),
+            mReseedThreshold(rhs.mReseedThreshold),
+            mReseedFloor(rhs.mReseedFloor) {}
 
-    HashMap& operator=(HashMap rhs) {
-        swap(rhs);
+    // Leaves rhs empty and without buckets: lookups in it miss without touching the table, and its next
+    // insertion allocates buckets the way growth does. rhs draws a fresh seed, which cannot throw once a map
+    // has been constructed.
+    HashMap(HashMap&& rhs) noexcept(std::is_nothrow_copy_constructible_v<Hash> &&
+                                    std::is_nothrow_copy_constructible_v<KeyEqual>) :
+            mTable(std::move(rhs.mTable)),
+            mHash(rhs.mHash),
+            mKeyEqual(rhs.mKeyEqual),
+            mMaxLoadFactor(rhs.mMaxLoadFactor),
+            mMinLoadFactor(rhs.mMinLoadFactor),
+            mSeed(std::exchange(rhs.mSeed, randomSeed())),
+            mReseedThreshold(rhs.mReseedThreshold),
+            mReseedFloor(std::exchange(rhs.mReseedFloor, 0)) {}
+
+    // Assignment keeps this map's allocator, so a map bound to an arena never takes nodes owned by another.
+    HashMap& operator=(const HashMap& rhs) {
+        HashMap copy(rhs, get_allocator());
+        swap(copy);
         return *this;
     }
 
-    template<typename IIter>
-    HashMap(IIter begin, IIter end, Hash hash = Hash()) : HashMap(hash) {
-        while (begin != end) {
-            insert(*begin++);
+    // Swaps when the allocators are equal, which is always for std::allocator.
+    HashMap& operator=(HashMap&& rhs) noexcept(std::allocator_traits<Allocator>::is_always_equal::value &&
+                                               std::is_nothrow_swappable_v<Hash> &&
+                                               std::is_nothrow_swappable_v<KeyEqual>) {
+        if (std::allocator_traits<Allocator>::is_always_equal::value || get_allocator() == rhs.get_allocator()) {
+            swap(rhs);
+        } else {
+            *this = static_cast<const HashMap&>(rhs);
         }
+        return *this;
+    }
+
+    template<typename IIter>
+    HashMap(IIter begin,
+            IIter end,
+            Hash hash = Hash(),
+            KeyEqual keyEqual = KeyEqual(),
+            const Allocator& allocator = Allocator()) :
+            HashMap(hash, keyEqual, allocator) {
+        insert_bulk(begin, end);
     }
 
-    HashMap(std::initializer_list<StoredType> init, Hash hash = Hash()) : HashMap(init.begin(), init.end(), hash) {}
+    HashMap(std::initializer_list<StoredType> init,
+            Hash hash = Hash(),
+            KeyEqual keyEqual = KeyEqual(),
+            const Allocator& allocator = Allocator()) :
+            HashMap(init.begin(), init.end(), hash, keyEqual, allocator) {}
+
+    Allocator get_allocator() const {
+        return mTable.get_allocator();
+    }
 
     size_t size() const {
-        return mSize;
+        return mTable.size();
     }
 
     bool empty() const {
@@ -157,97 +2982,378 @@ public:
         return mHash;
     }
 
+    KeyEqual key_eq() const {
+        return mKeyEqual;
+    }
+
+    size_t bucket_count() const {
+        return mTable.bucket_count();
+    }
+
+    float load_factor() const {
+        return bucket_count() == 0 ? 0.0f : static_cast<float>(size()) / bucket_count();
+    }
+
+    float max_load_factor() const {
+        return mMaxLoadFactor;
+    }
+
+    // Throws std::invalid_argument unless ml is positive; values above what the storage supports are capped.
+    void max_load_factor(float ml) {
+        if (!(ml > 0)) {
+            throw std::invalid_argument("HashMap: max_load_factor must be positive");
+        }
+        ml = std::min(ml, Table::MaxLoadFactorLimit);
+        // A reseed threshold still at its default follows the load; one set by reseed_threshold() stays.
+        if (mReseedThreshold == Table::reseed_threshold_for(mMaxLoadFactor)) {
+            mReseedThreshold = Table::reseed_threshold_for(ml);
+        }
+        mMaxLoadFactor = ml;
+        mMinLoadFactor = std::min(mMinLoadFactor, mMaxLoadFactor / 4);
+    }
+
+    float min_load_factor() const {
+        return mMinLoadFactor;
+    }
+
+    // Erasing below this load shrinks the table; 0, the default, never shrinks. Capped at a quarter of
+    // max_load_factor() so that a shrink is never undone by the next few insertions.
+    void min_load_factor(float ml) {
+        mMinLoadFactor = std::clamp(ml, 0.0f, mMaxLoadFactor / 4);
+    }
+
+    size_t seed() const {
+        return mSeed;
+    }
+
+    // Every map starts with a random seed of its own; a fixed one makes the iteration order reproducible.
+    // Keeps the bucket count. If Hash throws or memory runs out, the map keeps its old seed and entries.
+    void reseed(size_t seed) {
+        size_t oldSeed = mSeed;
+        mSeed = seed;
+        if (bucket_count() == 0) {
+            return;
+        }
+        // Every storage's relink(hashOf) places each entry by its hash under hashOf, which may differ from the
+        // one it was placed with, keeping the bucket count. If hashOf throws, the table is left as it was.
+        try {
+            timeRehash([&] {
+                mTable.relink(hashOfStored());
+            });
+        } catch (...) {
+            mSeed = oldSeed;
+            throw;
+        }
+    }
+
+    size_t reseed_threshold() const {
+        return mReseedThreshold;
+    }
+
+    // An insertion of a single entry whose chain or probe sequence is already longer than this, in the units
+    // of HashMapStats::max_probe_length, reseeds the map first. 0 never reseeds. Defaults to a length random
+    // keys practically never reach at max_load_factor(), and follows it until set.
+    void reseed_threshold(size_t threshold) {
+        mReseedThreshold = threshold;
+    }
+
+    // Heap memory behind the entries, not counting the HashMap object itself. Node sizes and allocator slack
+    // are estimates; the slack assumes the allocator gets its memory from malloc.
+    HashMapMemoryUsage memory_usage() const {
+        return mTable.memory_usage();
+    }
+
+    // Walks every entry to measure probe lengths, so costs as much as iterating the map. The operation
+    // counters are filled in only with a counting Stats policy such as CountingStats.
+    HashMapStats stats() const {
+        HashMapStats result;
+        result.size = size();
+        result.bucket_count = bucket_count();
+        result.load_factor = load_factor();
+        result.bytes_allocated = memory_usage().allocated();
+        size_t total = 0;
+        mTable.for_each_probe_length(hashOfStored(), [&](size_t length) {
+            if (result.probe_length_histogram.size() < length) {
+                result.probe_length_histogram.resize(length);
+            }
+            ++result.probe_length_histogram[length - 1];
+            total += length;
+        });
+        result.max_probe_length = result.probe_length_histogram.size();
+        if (!empty()) {
+            result.average_probe_length = static_cast<double>(total) / size();
+        }
+        counters().report(result);
+        return result;
+    }
+
+    // Unlike reserve, may shrink the table, down to what size() needs. Storages that support it relink the
+    // entries from up to threads threads when growing; the others ignore threads.
+    void rehash(size_t bucketCount, size_t threads = 1) {
+        bucketCount = Table::bucket_count_for(std::max(bucketCount, bucketsFor(size())));
+        if (bucketCount != bucket_count()) {
+            rehashTable(bucketCount, threads);
+        }
+    }
+
+    void reserve(size_t count, size_t threads = 1) {
+        if (bucketsFor(count) > bucket_count()) {
+            rehash(bucketsFor(count), threads);
+        }
+        mTable.reserve(count);
+    }
+
+    void shrink_to_fit() {
+        rehash(0);
+    }
+
     iterator begin() {
-        return iterator(mData.begin(), mData.end(), mData.front().begin());
+        return mTable.begin();
     }
 
     iterator end() {
-        return iterator(mData.end(), mData.end());
+        return mTable.end();
     }
 
     const_iterator begin() const {
-        return const_iterator(mData.cbegin(), mData.cend(), mData.front().cbegin());
+        return mTable.begin();
     }
 
     const_iterator end() const {
-        return const_iterator(mData.cend(), mData.cend());
+        return mTable.end();
+    }
+
+    std::pair<iterator, bool> insert(const StoredType& in) {
+        return emplaceUnique(in.first, in.second);
+    }
+
+    std::pair<iterator, bool> insert(StoredType&& in) {
+        return emplaceUnique(in.first, std::move(in.second));
     }
 
-    std::pair<iterator, bool> insert(StoredType in) {
-        if (loadFactor() > maxLoadFactor) {
-            rehash();
+    // Sizes the table once, hashes every entry, then places them slice by slice of the bucket array. Like
+    // insert, keeps the first of several entries with equal keys. Tables that keep insertion order are only
+    // sized up front, as are input iterators.
+    template<typename IIter>
+    void insert_bulk(IIter first, IIter last) {
+        using Category = typename std::iterator_traits<IIter>::iterator_category;
+        constexpr bool Forward = std::is_base_of_v<std::forward_iterator_tag, Category>;
+        if constexpr (Forward) {
+            reserve(size() + std::distance(first, last));
         }
-        size_t index = indexOf(in.first);
-        for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
-            if (it->first == in.first) {
-                return {iterator(mData.begin() + index, mData.end(), it), false};
+        if constexpr (!Forward || Table::KeepsInsertionOrder) {
+            while (first != last) {
+                insert(*first++);
+            }
+        } else {
+            std::vector<std::pair<size_t, IIter>> hashed;
+            hashed.reserve(std::distance(first, last));
+            for (; first != last; ++first) {
+                hashed.emplace_back(hashOf((*first).first), first);
+            }
+            partitionByBucket(hashed);
+            for (const auto& [hash, it] : hashed) {
+                if (mTable.find(hash, keyEquals((*it).first)) == mTable.end()) {
+                    reserveForInsert();
+                    mTable.emplace(hash, *it);
+                    counters().inserted();
+                }
             }
         }
-        auto pos = mData[index].insert(mData[index].end(), std::move(in));
-        ++mSize;
-        return {iterator(mData.begin() + index, mData.end(), pos), true};
     }
 
-    void erase(const Key& key) {
-        size_t index = indexOf(key);
-        for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
-            if (it->first == key) {
-                mData[index].erase(it);
-                --mSize;
+    // insert_bulk with hashing and placement spread over up to threads threads. Hash, KeyEqual and the
+    // allocator are then used from several threads at once. Storages without parallel support and ranges
+    // that are not random access are built by insert_bulk(first, last).
+    template<typename RIter>
+    void insert_bulk(RIter first, RIter last, size_t threads) {
+        using Category = typename std::iterator_traits<RIter>::iterator_category;
+        if constexpr (!Table::SupportsParallel || !std::is_base_of_v<std::random_access_iterator_tag, Category>) {
+            insert_bulk(first, last);
+        } else {
+            size_t count = last - first;
+            if (count == 0) {
                 return;
             }
+            reserve(size() + count, threads);
+            std::vector<std::pair<size_t, RIter>> hashed(count);
+            parallelFor(threads, count, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i != end; ++i) {
+                    hashed[i] = {hashOf(first[i].first), first + i};
+                }
+            });
+            size_t before = size();
+            mTable.emplace_parallel(hashed, [this](RIter it) {
+                return keyEquals((*it).first);
+            }, threads);
+            counters().inserted(size() - before);
         }
     }
 
-    iterator find(const Key& key) {
-        size_t index = indexOf(key);
-        for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
-            if (it->first == key) {
-                return iterator(mData.begin() + index, mData.end(), it);
-            }
+    template<typename K, typename V, typename = std::enable_if_t<std::is_same_v<std::decay_t<K>, Key>>>
+    std::pair<iterator, bool> emplace(K&& key, V&& value) {
+        return emplaceUnique(std::forward<K>(key), std::forward<V>(value));
+    }
+
+    // The key can only be looked up once it exists, so arbitrary arguments build the pair up front.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return insert(StoredType(std::forward<Args>(args)...));
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return emplaceUnique(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        return emplaceUnique(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value) {
+        auto result = emplaceUnique(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
         }
-        return end();
+        return result;
     }
 
-    const_iterator find(const Key& key) const {
-        size_t index = indexOf(key);
-        for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
-            if (it->first == key) {
-                return const_iterator(mData.begin() + index, mData.end(), it);
-            }
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value) {
+        auto result = emplaceUnique(std::move(key), std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
         }
-        return end();
+        return result;
+    }
+
+    void erase(const Key& key) {
+        eraseKey(key, hashOf(key));
+    }
+
+    template<typename K, typename = EnableIfTransparent<K>>
+    void erase(const K& key) {
+        eraseKey(key, hashOf(key));
+    }
+
+    iterator find(const Key& key) {
+        return findKey(key);
+    }
+
+    const_iterator find(const Key& key) const {
+        return findKey(key);
+    }
+
+    template<typename K, typename = EnableIfTransparent<K>>
+    iterator find(const K& key) {
+        return findKey(key);
+    }
+
+    template<typename K, typename = EnableIfTransparent<K>>
+    const_iterator find(const K& key) const {
+        return findKey(key);
+    }
+
+    // Writes find(key) for every key of the forward range [first, last) to out.
+    template<typename KeyIter, typename OutIter>
+    OutIter find_many(KeyIter first, KeyIter last, OutIter out) {
+        forEachLookup(*this, first, last, [&](iterator it) {
+            *out++ = it;
+        });
+        return out;
+    }
+
+    template<typename KeyIter, typename OutIter>
+    OutIter find_many(KeyIter first, KeyIter last, OutIter out) const {
+        forEachLookup(*this, first, last, [&](const_iterator it) {
+            *out++ = it;
+        });
+        return out;
+    }
+
+    // Writes whether each key of the forward range [first, last) is present to out.
+    template<typename KeyIter, typename OutIter>
+    OutIter contains_many(KeyIter first, KeyIter last, OutIter out) const {
+        forEachLookup(*this, first, last, [&](const_iterator it) {
+            *out++ = it != end();
+        });
+        return out;
     }
 
     Value& operator[](const Key& key) {
-        return insert(StoredType{key, Value()}).first->second;
+        return emplaceUnique(key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        return emplaceUnique(std::move(key)).first->second;
+    }
+
+    // The Key is only constructed from key when it is missing.
+    template<typename K, typename = EnableIfTransparent<std::decay_t<K>>>
+    Value& operator[](K&& key) {
+        return emplaceUnique(std::forward<K>(key)).first->second;
     }
 
     const Value& at(const Key& key) const {
-        size_t index = indexOf(key);
-        for (auto it = mData[index].begin(); it != mData[index].end(); ++it) {
-            if (it->first == key) {
-                return it->second;
-            }
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("");
         }
-        throw std::out_of_range("");
+        return it->second;
     }
 
+    template<typename K, typename = EnableIfTransparent<K>>
+    const Value& at(const K& key) const {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("");
+        }
+        return it->second;
+    }
+
+    // Returns the bucket array to its minimum size when a minimum load factor is set.
     void clear() {
-        for (auto& bucket : mData) {
-            bucket.clear();
+        if (mTable.occupied() == 0) {
+            return;
         }
-        mSize = 0;
+        mTable.clear();
+        shrinkIfSparse();
     }
 
-    void swap(HashMap& rhs) noexcept(std::is_nothrow_swappable_v<Hash>) {
+    void swap(HashMap& rhs) noexcept(std::is_nothrow_swappable_v<Hash> && std::is_nothrow_swappable_v<KeyEqual>) {
         std::swap(mHash, rhs.mHash);
-        mData.swap(rhs.mData);
-        std::swap(mSize, rhs.mSize);
+        std::swap(mKeyEqual, rhs.mKeyEqual);
+        mTable.swap(rhs.mTable);
+        std::swap(mMaxLoadFactor, rhs.mMaxLoadFactor);
+        std::swap(mMinLoadFactor, rhs.mMinLoadFactor);
+        std::swap(mSeed, rhs.mSeed);
+        std::swap(mReseedThreshold, rhs.mReseedThreshold);
+        std::swap(mReseedFloor, rhs.mReseedFloor);
     }
 };
 
-template<typename K, typename V, typename H>
-void swap(HashMap<K, V, H>& lhs, HashMap<K, V, H>& rhs) {
+template<typename K, typename V, typename H, typename E, typename A, typename S, typename G, typename C>
+void swap(HashMap<K, V, H, E, A, S, G, C>& lhs, HashMap<K, V, H, E, A, S, G, C>& rhs) {
     lhs.swap(rhs);
-}
\ No newline at end of file
+}
+
+namespace pmr {
+// Pass a std::pmr::monotonic_buffer_resource to release every node of a short-lived map at once.
+template<typename Key,
+         typename Value,
+         typename Hash = std::hash<Key>,
+         typename KeyEqual = std::equal_to<Key>,
+         typename Storage = ChainedStorage,
+         typename Growth = PowerOfTwoGrowth,
+         typename Stats = NoStats>
+using HashMap = ::HashMap<Key,
+                          Value,
+                          Hash,
+                          KeyEqual,
+                          std::pmr::polymorphic_allocator<std::pair<const Key, Value>>,
+                          Storage,
+                          Growth,
+                          Stats>;
+}
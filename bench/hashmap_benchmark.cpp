@@ -0,0 +1,308 @@
+#include "HashMap.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Run with --benchmark_filter to pick operations, maps or key types, e.g. --benchmark_filter='^find.*/Flat/'.
+// --benchmark_filter='^memory/' prints the bytes per entry of every storage instead of timings.
+
+namespace {
+
+template<typename Key>
+using StdMap = std::unordered_map<Key, uint64_t>;
+
+template<typename Key>
+using Chained = HashMap<Key, uint64_t>;
+
+template<typename Key>
+using Flat = HashMap<Key,
+                     uint64_t,
+                     std::hash<Key>,
+                     std::equal_to<Key>,
+                     std::allocator<std::pair<const Key, uint64_t>>,
+                     FlatStorage>;
+
+template<typename Key>
+using Ordered = HashMap<Key,
+                        uint64_t,
+                        std::hash<Key>,
+                        std::equal_to<Key>,
+                        std::allocator<std::pair<const Key, uint64_t>>,
+                        OrderedStorage>;
+
+template<typename Key>
+using Incremental = HashMap<Key,
+                            uint64_t,
+                            std::hash<Key>,
+                            std::equal_to<Key>,
+                            std::allocator<std::pair<const Key, uint64_t>>,
+                            IncrementalStorage>;
+
+// Fits the small string buffer of the common standard libraries.
+struct ShortString {};
+
+// Always allocated on the heap.
+struct LongString {};
+
+template<typename Kind>
+struct KeyOf {
+    using type = std::string;
+};
+
+template<>
+struct KeyOf<int64_t> {
+    using type = int64_t;
+};
+
+// Distinct n give distinct keys.
+template<typename Kind>
+typename KeyOf<Kind>::type makeKey(uint64_t n) {
+    if constexpr (std::is_same_v<Kind, int64_t>) {
+        return static_cast<int64_t>(mixHash(n));
+    } else if constexpr (std::is_same_v<Kind, ShortString>) {
+        return std::to_string(n);
+    } else {
+        return "a-long-key-that-never-fits-inline/" + std::to_string(n);
+    }
+}
+
+// Keys made with missing set are never equal to those made without it.
+template<typename Kind>
+std::vector<typename KeyOf<Kind>::type> makeKeys(size_t count, bool missing = false) {
+    std::vector<typename KeyOf<Kind>::type> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i != count; ++i) {
+        keys.push_back(makeKey<Kind>(i * 2 + (missing ? 1 : 0)));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(count));
+    return keys;
+}
+
+template<typename Map, typename Keys>
+Map makeMap(const Keys& keys) {
+    Map map;
+    for (size_t i = 0; i != keys.size(); ++i) {
+        map.insert({keys[i], i});
+    }
+    return map;
+}
+
+template<typename Map, typename Kind>
+void insert(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0));
+    for (auto _ : state) {
+        Map map;
+        for (size_t i = 0; i != keys.size(); ++i) {
+            map.insert({keys[i], i});
+        }
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<typename Map, typename Kind>
+void insertReserved(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0));
+    for (auto _ : state) {
+        Map map;
+        map.reserve(keys.size());
+        for (size_t i = 0; i != keys.size(); ++i) {
+            map.insert({keys[i], i});
+        }
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<typename Map, typename Kind>
+void findHit(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0));
+    Map map = makeMap<Map>(keys);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(keys[i]));
+        i = i + 1 == keys.size() ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Map, typename Kind>
+void findMiss(benchmark::State& state) {
+    Map map = makeMap<Map>(makeKeys<Kind>(state.range(0)));
+    auto missing = makeKeys<Kind>(state.range(0), true);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(missing[i]));
+        i = i + 1 == missing.size() ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The second argument is the maximum load factor in percent.
+template<typename Map, typename Kind>
+void findHitAtLoad(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0));
+    Map map;
+    map.max_load_factor(state.range(1) / 100.0f);
+    for (size_t i = 0; i != keys.size(); ++i) {
+        map.insert({keys[i], i});
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(keys[i]));
+        i = i + 1 == keys.size() ? 0 : i + 1;
+    }
+    state.counters["load_factor"] = map.load_factor();
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Map, typename Kind>
+void erase(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        Map map = makeMap<Map>(keys);
+        state.ResumeTiming();
+        for (const auto& key : keys) {
+            map.erase(key);
+        }
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template<typename Map, typename Kind>
+void iterate(benchmark::State& state) {
+    Map map = makeMap<Map>(makeKeys<Kind>(state.range(0)));
+    for (auto _ : state) {
+        uint64_t sum = 0;
+        for (const auto& entry : map) {
+            sum += entry.second;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+
+template<typename Map, typename Kind>
+void copy(benchmark::State& state) {
+    Map map = makeMap<Map>(makeKeys<Kind>(state.range(0)));
+    for (auto _ : state) {
+        Map copied(map);
+        benchmark::DoNotOptimize(copied);
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+
+// Half lookups, a quarter insertions and a quarter erasures over twice as many keys as the map holds, so
+// the size stays around the starting one.
+template<typename Map, typename Kind>
+void mixed(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0) * 2);
+    Map map;
+    for (size_t i = 0; i != keys.size(); i += 2) {
+        map.insert({keys[i], i});
+    }
+    std::mt19937_64 rng(2);
+    std::vector<uint32_t> ops(1 << 16);
+    for (auto& op : ops) {
+        op = static_cast<uint32_t>(rng());
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        uint32_t op = ops[i];
+        const auto& key = keys[op % keys.size()];
+        if (op >> 30 < 2) {
+            benchmark::DoNotOptimize(map.find(key));
+        } else if (op >> 30 == 2) {
+            map.insert({key, op});
+        } else {
+            map.erase(key);
+        }
+        i = i + 1 == ops.size() ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Reports HashMap::memory_usage() per entry of a map of range(0) keys, broken down the same way; the time is
+// that of building the map. Heap memory owned by the keys themselves is not included.
+template<typename Map, typename Kind>
+void memory(benchmark::State& state) {
+    auto keys = makeKeys<Kind>(state.range(0));
+    Map map;
+    for (auto _ : state) {
+        map = makeMap<Map>(keys);
+    }
+    HashMapMemoryUsage usage = map.memory_usage();
+    double entries = static_cast<double>(map.size());
+    state.counters["bytes_per_entry"] = usage.total() / entries;
+    state.counters["buckets"] = usage.buckets / entries;
+    state.counters["entries"] = usage.entries / entries;
+    state.counters["metadata"] = usage.metadata / entries;
+    state.counters["slack"] = usage.allocator_slack / entries;
+    state.counters["load_factor"] = map.load_factor();
+}
+
+// From a few KiB, inside L1, to hundreds of MiB, well past the last level cache.
+void sizes(benchmark::internal::Benchmark* benchmark) {
+    benchmark->RangeMultiplier(16)->Range(1 << 8, 1 << 22);
+}
+
+void loads(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t load : {25, 50, 75, 90}) {
+        benchmark->Args({1 << 20, load});
+    }
+}
+
+template<template<typename> class Map, typename Kind>
+void registerMap(const std::string& mapName, const std::string& kindName) {
+    using M = Map<typename KeyOf<Kind>::type>;
+    using Ranges = void (*)(benchmark::internal::Benchmark*);
+    auto add = [&](const std::string& op, void (*fn)(benchmark::State&), Ranges ranges) {
+        benchmark::RegisterBenchmark((op + "/" + mapName + "/" + kindName).c_str(), fn)->Apply(ranges);
+    };
+    add("insert", insert<M, Kind>, sizes);
+    add("insertReserved", insertReserved<M, Kind>, sizes);
+    add("findHit", findHit<M, Kind>, sizes);
+    add("findMiss", findMiss<M, Kind>, sizes);
+    add("findHitAtLoad", findHitAtLoad<M, Kind>, loads);
+    add("erase", erase<M, Kind>, sizes);
+    add("iterate", iterate<M, Kind>, sizes);
+    add("copy", copy<M, Kind>, sizes);
+    add("mixed", mixed<M, Kind>, sizes);
+}
+
+template<typename Kind>
+void registerKind(const std::string& kindName) {
+    registerMap<StdMap, Kind>("StdMap", kindName);
+    registerMap<Chained, Kind>("Chained", kindName);
+    registerMap<Incremental, Kind>("Incremental", kindName);
+    registerMap<Flat, Kind>("Flat", kindName);
+    registerMap<Ordered, Kind>("Ordered", kindName);
+    auto addMemory = [&](const std::string& mapName, void (*fn)(benchmark::State&)) {
+        benchmark::RegisterBenchmark(("memory/" + mapName + "/" + kindName).c_str(), fn)->Apply(sizes);
+    };
+    using K = typename KeyOf<Kind>::type;
+    addMemory("Chained", memory<Chained<K>, Kind>);
+    addMemory("Incremental", memory<Incremental<K>, Kind>);
+    addMemory("Flat", memory<Flat<K>, Kind>);
+    addMemory("Ordered", memory<Ordered<K>, Kind>);
+}
+
+// Names read operation/map/key/size, e.g. findHit/Flat/ShortString/65536.
+const bool registered = [] {
+    registerKind<int64_t>("int64");
+    registerKind<ShortString>("ShortString");
+    registerKind<LongString>("LongString");
+    return true;
+}();
+
+}
@@ -0,0 +1,397 @@
+#include "HashMap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// Replays a recorded operation log against HashMap<uint64_t, std::string> and reports throughput, latency
+// percentiles per operation, peak RSS and heap allocations.
+//
+//   trace_replay [--storage chained|flat|ordered|incremental] [--min-load-factor F] TRACE
+//   trace_replay --generate TRACE [--ops N] [--keys N] [--zipf S] [--value-size N] [--purge F] [--seed N]
+//
+// A trace is the 8 bytes "HMTRACE1" followed by records: one byte of operation (0 insert, 1 find,
+// 2 erase), the key as an LEB128 varint and, for insertions only, the value size in bytes as another varint.
+
+namespace {
+
+size_t gAllocations = 0;
+size_t gAllocatedBytes = 0;
+
+}
+
+void* operator new(size_t size) {
+    ++gAllocations;
+    gAllocatedBytes += size;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+constexpr char Magic[] = "HMTRACE1";
+
+enum class Op : uint8_t {
+    Insert,
+    Find,
+    Erase
+};
+
+constexpr const char* OpNames[] = {"insert", "find", "erase"};
+
+struct Record {
+    Op op;
+    uint32_t valueSize;
+    uint64_t key;
+};
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool getVarint(const unsigned char*& pos, const unsigned char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos != end && shift < 64; shift += 7) {
+        unsigned char byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Record> readTrace(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof()) {
+        throw std::runtime_error(std::string("cannot read ") + path);
+    }
+    if (data.compare(0, sizeof(Magic) - 1, Magic) != 0) {
+        throw std::runtime_error(std::string(path) + " is not a trace");
+    }
+    std::vector<Record> records;
+    auto pos = reinterpret_cast<const unsigned char*>(data.data()) + sizeof(Magic) - 1;
+    auto end = reinterpret_cast<const unsigned char*>(data.data()) + data.size();
+    while (pos != end) {
+        Record record{static_cast<Op>(*pos++), 0, 0};
+        uint64_t valueSize = 0;
+        if (record.op > Op::Erase || !getVarint(pos, end, record.key) ||
+            (record.op == Op::Insert && !getVarint(pos, end, valueSize))) {
+            throw std::runtime_error(std::string(path) + " is truncated or corrupt");
+        }
+        record.valueSize = static_cast<uint32_t>(valueSize);
+        records.push_back(record);
+    }
+    return records;
+}
+
+// Zipfian keys over [0, keys) with bursts of insertions of fresh keys and, every million operations, the
+// erasure of the fraction purge of the live keys in one run: the shapes synthetic benchmarks usually miss.
+void generateTrace(const char* path,
+                   size_t ops,
+                   size_t keys,
+                   double zipf,
+                   uint32_t valueSize,
+                   double purge,
+                   uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<double> cumulative(keys);
+    double total = 0;
+    for (size_t i = 0; i != keys; ++i) {
+        total += 1 / std::pow(static_cast<double>(i + 1), zipf);
+        cumulative[i] = total;
+    }
+    std::uniform_real_distribution<double> uniform(0, total);
+    auto zipfKey = [&] {
+        return static_cast<uint64_t>(std::lower_bound(cumulative.begin(), cumulative.end(), uniform(rng)) -
+                                     cumulative.begin());
+    };
+    // The keys the trace leaves in the map so far, so that a purge erases keys that are there.
+    std::vector<uint64_t> live;
+    HashMap<uint64_t, size_t> positions;
+    std::string out(Magic, sizeof(Magic) - 1);
+    uint64_t fresh = keys;
+    size_t purging = 0;
+    for (size_t i = 0; i != ops; ++i) {
+        if (i % 1000000 == 0 && i != 0) {
+            purging = static_cast<size_t>(live.size() * purge);
+        }
+        Op op;
+        uint64_t key;
+        if (purging != 0 && !live.empty()) {
+            --purging;
+            op = Op::Erase;
+            key = live[rng() % live.size()];
+        } else if (i % 100000 < 2000) {
+            op = Op::Insert;
+            key = fresh++;
+        } else {
+            uint64_t roll = rng() % 100;
+            op = roll < 70 ? Op::Find : roll < 90 ? Op::Insert : Op::Erase;
+            key = zipfKey();
+        }
+        if (op == Op::Insert && positions.emplace(key, live.size()).second) {
+            live.push_back(key);
+        } else if (op == Op::Erase) {
+            auto it = positions.find(key);
+            if (it != positions.end()) {
+                positions[live.back()] = it->second;
+                live[it->second] = live.back();
+                live.pop_back();
+                positions.erase(key);
+            }
+        }
+        out.push_back(static_cast<char>(op));
+        putVarint(out, key);
+        if (op == Op::Insert) {
+            putVarint(out, valueSize);
+        }
+    }
+    std::ofstream(path, std::ios::binary).write(out.data(), out.size());
+}
+
+// Log-linear buckets: 16 per power of two, so percentiles are within about 6% of the true value.
+class Histogram {
+private:
+    static constexpr int SubBits = 4;
+
+    std::vector<uint64_t> mCounts = std::vector<uint64_t>(64 << SubBits);
+    uint64_t mTotal = 0;
+    uint64_t mMax = 0;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < (1u << SubBits)) {
+            return ns;
+        }
+        int exponent = 63 - static_cast<int>(countLeadingZeros(ns));
+        size_t sub = (ns >> (exponent - SubBits)) & ((1u << SubBits) - 1);
+        return ((exponent - SubBits + 1) << SubBits) + sub;
+    }
+
+    static uint64_t upperBoundOf(size_t bucket) {
+        if (bucket < (1u << SubBits)) {
+            return bucket;
+        }
+        int exponent = static_cast<int>(bucket >> SubBits) + SubBits - 1;
+        uint64_t sub = bucket & ((1u << SubBits) - 1);
+        return ((uint64_t(1) << SubBits | sub) + 1) << (exponent - SubBits);
+    }
+
+public:
+    void add(uint64_t ns) {
+        ++mCounts[bucketOf(ns)];
+        ++mTotal;
+        mMax = std::max(mMax, ns);
+    }
+
+    uint64_t total() const {
+        return mTotal;
+    }
+
+    uint64_t max() const {
+        return mMax;
+    }
+
+    uint64_t percentile(double p) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100 * mTotal));
+        uint64_t seen = 0;
+        for (size_t i = 0; i != mCounts.size(); ++i) {
+            seen += mCounts[i];
+            if (seen >= rank && seen != 0) {
+                return std::min(upperBoundOf(i), mMax);
+            }
+        }
+        return mMax;
+    }
+};
+
+size_t peakRssKiB() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// A min_load_factor above 0 lets the purges shrink the table.
+template<typename Map>
+void replay(const std::vector<Record>& records, float minLoadFactor) {
+    using Clock = std::chrono::steady_clock;
+    Histogram latencies[3];
+    Histogram rehashes;
+    size_t hits = 0;
+    size_t rssBefore = peakRssKiB();
+    size_t allocationsBefore = gAllocations;
+    size_t bytesBefore = gAllocatedBytes;
+    Map map;
+    map.min_load_factor(minLoadFactor);
+    auto start = Clock::now();
+    for (const Record& record : records) {
+        size_t buckets = map.bucket_count();
+        auto before = Clock::now();
+        switch (record.op) {
+            case Op::Insert:
+                map.insert_or_assign(record.key, std::string(record.valueSize, 'v'));
+                break;
+            case Op::Find:
+                hits += map.find(record.key) != map.end();
+                break;
+            case Op::Erase:
+                map.erase(record.key);
+                break;
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count();
+        latencies[static_cast<size_t>(record.op)].add(ns);
+        if (map.bucket_count() != buckets) {
+            rehashes.add(ns);
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::printf("%zu ops in %.3f s: %.2f Mops/s, %zu entries at the end, %zu find hits\n",
+                records.size(), seconds, records.size() / seconds / 1e6, map.size(), hits);
+    std::printf("%-8s %12s %10s %10s %10s %10s\n", "op", "count", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+    auto row = [](const char* name, const Histogram& histogram) {
+        if (histogram.total() != 0) {
+            std::printf("%-8s %12llu %10llu %10llu %10llu %10llu\n",
+                        name,
+                        static_cast<unsigned long long>(histogram.total()),
+                        static_cast<unsigned long long>(histogram.percentile(50)),
+                        static_cast<unsigned long long>(histogram.percentile(99)),
+                        static_cast<unsigned long long>(histogram.percentile(99.9)),
+                        static_cast<unsigned long long>(histogram.max()));
+        }
+    };
+    for (size_t op = 0; op != 3; ++op) {
+        row(OpNames[op], latencies[op]);
+    }
+    // Operations during which the bucket count changed.
+    row("rehash", rehashes);
+    std::printf("peak RSS %zu KiB (%zu KiB before replaying), %zu allocations, %zu bytes allocated\n",
+                peakRssKiB(), rssBefore, gAllocations - allocationsBefore, gAllocatedBytes - bytesBefore);
+    HashMapMemoryUsage usage = map.memory_usage();
+    std::printf("table memory %zu bytes: %zu buckets, %zu entries, %zu metadata, %zu estimated slack\n",
+                usage.total(), usage.buckets, usage.entries, usage.metadata, usage.allocator_slack);
+}
+
+template<typename Storage>
+using TraceMap = HashMap<uint64_t,
+                         std::string,
+                         std::hash<uint64_t>,
+                         std::equal_to<uint64_t>,
+                         std::allocator<std::pair<const uint64_t, std::string>>,
+                         Storage>;
+
+int usage() {
+    std::fprintf(stderr,
+                 "usage: trace_replay [--storage chained|flat|ordered|incremental] [--min-load-factor F] TRACE\n"
+                 "       trace_replay --generate TRACE [--ops N] [--keys N] [--zipf S] [--value-size N] "
+                 "[--purge F] [--seed N]\n");
+    return 2;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string storage = "chained";
+    float minLoadFactor = 0;
+    const char* generate = nullptr;
+    const char* trace = nullptr;
+    size_t ops = 10000000;
+    size_t keys = 1000000;
+    double zipf = 0.99;
+    uint32_t valueSize = 16;
+    double purge = 0.5;
+    uint64_t seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--storage" && hasValue) {
+            storage = argv[++i];
+        } else if (arg == "--min-load-factor" && hasValue) {
+            minLoadFactor = std::strtof(argv[++i], nullptr);
+        } else if (arg == "--generate" && hasValue) {
+            generate = argv[++i];
+        } else if (arg == "--ops" && hasValue) {
+            ops = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--keys" && hasValue) {
+            keys = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--zipf" && hasValue) {
+            zipf = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--value-size" && hasValue) {
+            valueSize = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--purge" && hasValue) {
+            purge = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--seed" && hasValue) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg[0] != '-' && trace == nullptr) {
+            trace = argv[i];
+        } else {
+            return usage();
+        }
+    }
+
+    try {
+        if (generate != nullptr) {
+            if (keys == 0 || !(purge >= 0 && purge <= 1)) {
+                return usage();
+            }
+            generateTrace(generate, ops, keys, zipf, valueSize, purge, seed);
+            return 0;
+        }
+        if (trace == nullptr) {
+            return usage();
+        }
+        std::vector<Record> records = readTrace(trace);
+        if (storage == "chained") {
+            replay<TraceMap<ChainedStorage>>(records, minLoadFactor);
+        } else if (storage == "flat") {
+            replay<TraceMap<FlatStorage>>(records, minLoadFactor);
+        } else if (storage == "ordered") {
+            replay<TraceMap<OrderedStorage>>(records, minLoadFactor);
+        } else if (storage == "incremental") {
+            replay<TraceMap<IncrementalStorage>>(records, minLoadFactor);
+        } else {
+            return usage();
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "trace_replay: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,428 @@
+#include "ConcurrentHashMap.h"
+#include "HashMap.h"
+
+#include "check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Behaviour of the public API that the differential test cannot see, because std::unordered_map shows none of
+// it: what reserve saves, what a move leaves behind, what try_emplace and a transparent lookup avoid, what
+// CountingStats counts and what max_load_factor rejects, checked on every storage, how often ConcurrentHashMap
+// hashes a key, and the iteration order of OrderedStorage.
+
+namespace {
+
+// Counts its copies; pair<const Key, Value> can only copy its key, so every relocation of an entry shows up.
+struct CountedKey {
+    static inline size_t copies = 0;
+
+    uint64_t value;
+
+    explicit CountedKey(uint64_t value) : value(value) {}
+
+    CountedKey(const CountedKey& rhs) : value(rhs.value) {
+        ++copies;
+    }
+
+    CountedKey(CountedKey&& rhs) noexcept = default;
+
+    bool operator==(const CountedKey& rhs) const {
+        return value == rhs.value;
+    }
+};
+
+struct CountedKeyHash {
+    size_t operator()(const CountedKey& key) const {
+        return std::hash<uint64_t>()(key.value);
+    }
+};
+
+template<typename Storage>
+using CountedMap = HashMap<CountedKey,
+                           uint64_t,
+                           CountedKeyHash,
+                           std::equal_to<CountedKey>,
+                           std::allocator<std::pair<const CountedKey, uint64_t>>,
+                           Storage>;
+
+// After reserve, inserting that many entries neither rehashes nor moves an entry already in place.
+template<typename Storage>
+void reserveAvoidsCopies(const char* name) {
+    CountedMap<Storage> map;
+    map.reserve(100000);
+    size_t bucketCount = map.bucket_count();
+    CountedKey::copies = 0;
+    for (uint64_t n = 0; n != 100000; ++n) {
+        map.emplace(CountedKey(n), n);
+    }
+    CHECK(map.bucket_count() == bucketCount);
+    CHECK(CountedKey::copies == 0);
+    std::printf("%s: reserve ok\n", name);
+}
+
+// Growing FlatStorage and compacting or rehashing OrderedStorage move the keys into place rather than copy
+// them. OrderedStorage's entry vector still copies them when it regrows, so it is reserved first.
+template<typename Storage>
+void relocationMovesKeys(const char* name) {
+    CountedMap<Storage> map;
+    if constexpr (std::is_same_v<Storage, OrderedStorage>) {
+        map.reserve(100000);
+    }
+    CountedKey::copies = 0;
+    for (uint64_t n = 0; n != 100000; ++n) {
+        map.emplace(CountedKey(n), n);
+    }
+    for (uint64_t n = 0; n != 100000; n += 4) {
+        for (uint64_t k = n; k != n + 3; ++k) {
+            map.erase(CountedKey(k));
+        }
+    }
+    map.rehash(map.bucket_count() * 4);
+    map.shrink_to_fit();
+    CHECK(map.size() == 25000 && map.at(CountedKey(99999)) == 99999);
+    CHECK(CountedKey::copies == 0);
+    std::printf("%s: relocation ok\n", name);
+}
+
+// A move allocates nothing and cannot throw. The moved-from map has no buckets, and takes insertions, lookups,
+// erasures and clear() like a new one.
+template<typename Storage>
+void movedFromIsUsable(const char* name) {
+    static_assert(std::is_nothrow_move_constructible_v<CountedMap<Storage>>);
+    static_assert(std::is_nothrow_move_assignable_v<CountedMap<Storage>>);
+    CountedMap<Storage> map;
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.emplace(CountedKey(n), n);
+    }
+    CountedMap<Storage> moved(std::move(map));
+    CHECK(moved.size() == 1000 && moved.find(CountedKey(999)) != moved.end());
+    CHECK(map.size() == 0 && map.empty() && map.begin() == map.end());
+    CHECK(map.bucket_count() == 0 && map.memory_usage().allocated() == 0 && map.load_factor() == 0);
+    CountedKey keys[] = {CountedKey(1), CountedKey(2)};
+    bool found[] = {true, true};
+    map.contains_many(std::begin(keys), std::end(keys), found);
+    CHECK(map.find(CountedKey(1)) == map.end() && !found[0] && !found[1]);
+    map.erase(CountedKey(1));
+    map.clear();
+    map.reseed(7);
+    CHECK(map.stats().size == 0 && CountedMap<Storage>(map).empty());
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.emplace(CountedKey(n), n + 1);
+    }
+    CHECK(map.size() == 1000 && map.at(CountedKey(999)) == 1000);
+    map.clear();
+    CHECK(map.empty() && moved.size() == 1000);
+    CountedMap<Storage> other(std::move(moved));
+    std::vector<std::pair<const CountedKey, uint64_t>> entries(other.begin(), other.end());
+    moved.insert_bulk(entries.begin(), entries.end());
+    CHECK(moved.size() == 1000 && moved.at(CountedKey(999)) == 999);
+    std::printf("%s: move ok\n", name);
+}
+
+// Counts its constructions from a source, which it takes by value and so empties.
+struct CountedValue {
+    static inline size_t constructions = 0;
+
+    uint64_t value;
+
+    explicit CountedValue(std::unique_ptr<uint64_t> source) : value(*source) {
+        ++constructions;
+    }
+};
+
+// try_emplace neither constructs the value nor consumes its arguments when the key is present, even when they
+// are moved in, and neither does it move from an rvalue key.
+template<typename Storage>
+void tryEmplaceKeepsArguments(const char* name) {
+    HashMap<std::string,
+            CountedValue,
+            std::hash<std::string>,
+            std::equal_to<std::string>,
+            std::allocator<std::pair<const std::string, CountedValue>>,
+            Storage>
+            map;
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.try_emplace(std::to_string(n), std::make_unique<uint64_t>(n));
+    }
+    CountedValue::constructions = 0;
+    auto argument = std::make_unique<uint64_t>(1000);
+    std::string key = "a key long enough to allocate 500";
+    CHECK(map.try_emplace(key, std::make_unique<uint64_t>(0)).second);
+    CHECK(CountedValue::constructions == 1);
+    auto [it, inserted] = map.try_emplace(std::move(key), std::move(argument));
+    CHECK(!inserted && it->second.value == 0);
+    CHECK(argument != nullptr && *argument == 1000 && key == "a key long enough to allocate 500");
+    CHECK(!map.try_emplace("7", std::move(argument)).second && argument != nullptr);
+    CHECK(CountedValue::constructions == 1 && map.size() == 1001);
+    std::printf("%s: try_emplace ok\n", name);
+}
+
+// Transparent hash and equality that count the calls made with a std::string in place of every key, which is
+// what a lookup by a std::string_view makes if it builds a temporary Key.
+struct StringHash {
+    using is_transparent = void;
+
+    static inline size_t stringCalls = 0;
+
+    size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>()(key);
+    }
+
+    size_t operator()(const std::string& key) const {
+        ++stringCalls;
+        return std::hash<std::string_view>()(key);
+    }
+};
+
+struct StringEqual {
+    using is_transparent = void;
+
+    static inline size_t stringCalls = 0;
+
+    bool operator()(std::string_view lhs, std::string_view rhs) const {
+        return lhs == rhs;
+    }
+
+    bool operator()(const std::string& lhs, const std::string& rhs) const {
+        ++stringCalls;
+        return lhs == rhs;
+    }
+};
+
+// Lookups, erasure and operator[] by a std::string_view find std::string keys without building a std::string;
+// operator[] only builds one to insert a missing key.
+template<typename Storage>
+void transparentLookup(const char* name) {
+    HashMap<std::string,
+            uint64_t,
+            StringHash,
+            StringEqual,
+            std::allocator<std::pair<const std::string, uint64_t>>,
+            Storage>
+            map;
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.emplace("a key long enough to allocate " + std::to_string(n), n);
+    }
+    StringHash::stringCalls = 0;
+    StringEqual::stringCalls = 0;
+    std::string_view present = "a key long enough to allocate 500";
+    std::string_view missing = "a key long enough to allocate 1000";
+    const auto& constMap = map;
+    CHECK(map.find(present) != map.end() && map.find(present)->second == 500);
+    CHECK(constMap.find(present) != constMap.end() && constMap.at(present) == 500);
+    CHECK(map.find(missing) == map.end());
+    map[present] = 501;
+    map.erase(present);
+    CHECK(map.find(present) == map.end() && map.size() == 999);
+    CHECK(StringHash::stringCalls == 0 && StringEqual::stringCalls == 0);
+    map[missing] = 1000;
+    CHECK(map.size() == 1000 && map.at(std::string(missing)) == 1000);
+    std::printf("%s: transparent lookup ok\n", name);
+}
+
+struct CountedHash {
+    static inline size_t calls = 0;
+
+    size_t operator()(uint64_t key) const {
+        ++calls;
+        return std::hash<uint64_t>()(key);
+    }
+};
+
+// A ConcurrentHashMap hashes the key once per operation: the shard reuses the hash that picked it.
+template<typename Storage>
+void concurrentHashesOnce(const char* name) {
+    ConcurrentHashMap<uint64_t,
+                      uint64_t,
+                      CountedHash,
+                      std::equal_to<uint64_t>,
+                      std::allocator<std::pair<const uint64_t, uint64_t>>,
+                      Storage>
+            map(4);
+    map.reserve(4000);
+    CountedHash::calls = 0;
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.insert({n, n});
+    }
+    CHECK(CountedHash::calls == 1000);
+    CountedHash::calls = 0;
+    CHECK(map.try_emplace(1000, 1000) && !map.try_emplace(0, 1));
+    CHECK(!map.insert_or_assign(0, 1) && map.insert_or_assign(1001, 1001));
+    CHECK(map.contains(0) && map.find(0) == 1 && !map.find(2000));
+    CHECK(map.visit(1, [](auto& stored) { stored.second = 2; }));
+    CHECK(std::as_const(map).visit(1, [](const auto& stored) { CHECK(stored.second == 2); }));
+    CHECK(map.erase(1001) && !map.erase(1001));
+    CHECK(CountedHash::calls == 11);
+    CHECK(map.size() == 1001);
+    std::printf("%s: concurrent hashing ok\n", name);
+}
+
+// Throws from its constructor when asked to.
+struct ThrowingValue {
+    uint64_t value;
+
+    explicit ThrowingValue(uint64_t value, bool fail = false) : value(value) {
+        if (fail) {
+            throw std::runtime_error("ThrowingValue");
+        }
+    }
+};
+
+// CountingStats counts every lookup exactly once, insertion probes never as lookups, and insertions only
+// once the entry is in place.
+template<typename Storage>
+void countingStats(const char* name) {
+    HashMap<uint64_t,
+            ThrowingValue,
+            std::hash<uint64_t>,
+            std::equal_to<uint64_t>,
+            std::allocator<std::pair<const uint64_t, ThrowingValue>>,
+            Storage,
+            PowerOfTwoGrowth,
+            CountingStats>
+            map;
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.try_emplace(n, n);
+    }
+    map.try_emplace(0, 0);
+    map.insert_or_assign(1, ThrowingValue(1));
+    bool threw = false;
+    try {
+        map.try_emplace(1000, 1000, true);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw && map.size() == 1000);
+    HashMapStats stats = map.stats();
+    CHECK(stats.lookups == 0 && stats.insertions == 1000 && stats.erasures == 0 && stats.rehashes != 0);
+
+    const auto& constMap = map;
+    for (uint64_t n = 0; n != 2000; ++n) {
+        map.find(n);
+    }
+    CHECK(constMap.at(999).value == 999);
+    std::vector<uint64_t> keys = {5, 2000, 6};
+    std::vector<bool> present;
+    constMap.contains_many(keys.begin(), keys.end(), std::back_inserter(present));
+    map.erase(10);
+    map.erase(2000);
+    stats = map.stats();
+    CHECK(stats.lookups == 2004 && stats.hits == 1003 && stats.misses == 1001);
+    CHECK(stats.insertions == 1000 && stats.erasures == 1);
+    CHECK(stats.key_comparisons >= stats.hits);
+    std::printf("%s: stats ok\n", name);
+}
+
+// OrderedStorage iterates in insertion order through erasures, compaction, reinsertion, rehashes and reseeds.
+// Assigning to a present key keeps its place; erasing and reinserting it moves it to the end.
+void orderedIteration() {
+    HashMap<uint64_t,
+            uint64_t,
+            std::hash<uint64_t>,
+            std::equal_to<uint64_t>,
+            std::allocator<std::pair<const uint64_t, uint64_t>>,
+            OrderedStorage>
+            map;
+    std::vector<uint64_t> order;
+    auto check = [&] {
+        CHECK(map.size() == order.size());
+        auto it = map.begin();
+        for (uint64_t key : order) {
+            CHECK(it != map.end() && it->first == key);
+            ++it;
+        }
+        CHECK(it == map.end());
+    };
+    std::mt19937_64 random(1);
+    for (uint64_t n = 0; n != 1000; ++n) {
+        uint64_t key = random();
+        if (map.emplace(key, n).second) {
+            order.push_back(key);
+        }
+    }
+    check();
+    // Erasing more than half of the entries compacts them.
+    std::vector<uint64_t> erased;
+    for (size_t i = 0; i != order.size(); ++i) {
+        if (i % 4 != 0) {
+            map.erase(order[i]);
+            erased.push_back(order[i]);
+        }
+    }
+    order.erase(std::remove_if(order.begin(), order.end(), [&](uint64_t key) {
+        return map.find(key) == map.end();
+    }), order.end());
+    check();
+    for (size_t i = 0; i != erased.size(); i += 3) {
+        map.emplace(erased[i], i);
+        order.push_back(erased[i]);
+    }
+    map.insert_or_assign(order.front(), 0);
+    map.erase(order[1]);
+    map.emplace(order[1], 0);
+    std::rotate(order.begin() + 1, order.begin() + 2, order.end());
+    check();
+    map.rehash(4096);
+    check();
+    map.reseed(7);
+    check();
+    map.shrink_to_fit();
+    check();
+    std::printf("ordered: iteration order ok\n");
+}
+
+// max_load_factor rejects zero, negative and NaN values and keeps the one it had.
+template<typename Storage>
+void maxLoadFactorRejectsInvalid(const char* name) {
+    CountedMap<Storage> map;
+    map.max_load_factor(0.5f);
+    for (float ml : {0.0f, -1.0f, std::numeric_limits<float>::quiet_NaN()}) {
+        bool threw = false;
+        try {
+            map.max_load_factor(ml);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        CHECK(threw && map.max_load_factor() == 0.5f);
+    }
+    for (uint64_t n = 0; n != 1000; ++n) {
+        map.emplace(CountedKey(n), n);
+    }
+    CHECK(map.size() == 1000 && map.load_factor() <= 0.5f);
+    std::printf("%s: max_load_factor ok\n", name);
+}
+
+template<typename Storage>
+void run(const char* name) {
+    reserveAvoidsCopies<Storage>(name);
+    movedFromIsUsable<Storage>(name);
+    tryEmplaceKeepsArguments<Storage>(name);
+    transparentLookup<Storage>(name);
+    countingStats<Storage>(name);
+    concurrentHashesOnce<Storage>(name);
+    maxLoadFactorRejectsInvalid<Storage>(name);
+}
+
+}
+
+int main() {
+    run<ChainedStorage>("chained");
+    run<IncrementalStorage>("incremental");
+    run<FlatStorage>("flat");
+    run<OrderedStorage>("ordered");
+    relocationMovesKeys<FlatStorage>("flat");
+    relocationMovesKeys<OrderedStorage>("ordered");
+    orderedIteration();
+}
@@ -0,0 +1,317 @@
+#include "ConcurrentHashMap.h"
+#include "HashMap.h"
+
+#include "check.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Replays random operations against every storage, growth policy and StoreHash setting and compares each
+// result with std::unordered_map. Reseeds, threaded rehashes and bulk builds, and readers running
+// concurrently with each other are part of the mix; build with HASHMAP_SANITIZER=thread to check the
+// threaded paths for races. ConcurrentHashMap and RcuHashMap run their writers and readers at once.
+
+struct StoredKey {
+    uint64_t value;
+
+    bool operator==(const StoredKey& rhs) const {
+        return value == rhs.value;
+    }
+};
+
+template<>
+struct StoreHash<StoredKey> : std::true_type {};
+
+// Same as StoredKey, but nodes keep only the key and the hash is recomputed on every rehash.
+struct PlainKey {
+    uint64_t value;
+
+    bool operator==(const PlainKey& rhs) const {
+        return value == rhs.value;
+    }
+};
+
+namespace {
+
+struct KeyHash {
+    template<typename Key>
+    size_t operator()(const Key& key) const {
+        return std::hash<uint64_t>()(key.value);
+    }
+};
+
+template<typename Key, typename Storage, typename Growth>
+using TestMap = HashMap<Key,
+                        uint64_t,
+                        KeyHash,
+                        std::equal_to<Key>,
+                        std::allocator<std::pair<const Key, uint64_t>>,
+                        Storage,
+                        Growth>;
+
+constexpr uint64_t KeyRange = 4000;
+constexpr size_t Steps = 40000;
+constexpr size_t Readers = 4;
+
+template<typename Key>
+Key makeKey(uint64_t n) {
+    return Key{n};
+}
+
+using Reference = std::unordered_map<uint64_t, uint64_t>;
+
+template<typename Key, typename Map>
+void checkFind(const Map& map, const Reference& reference, uint64_t n) {
+    auto it = map.find(makeKey<Key>(n));
+    auto expected = reference.find(n);
+    CHECK((it != map.end()) == (expected != reference.end()));
+    CHECK(it == map.end() || it->second == expected->second);
+}
+
+template<typename Key, typename Map>
+void checkAll(const Map& map, const Reference& reference) {
+    CHECK(map.size() == reference.size());
+    size_t iterated = 0;
+    for (const auto& entry : map) {
+        auto expected = reference.find(entry.first.value);
+        CHECK(expected != reference.end() && expected->second == entry.second);
+        ++iterated;
+    }
+    CHECK(iterated == reference.size());
+    for (uint64_t n = 0; n != KeyRange; ++n) {
+        checkFind<Key>(map, reference, n);
+    }
+}
+
+// Const lookups from several threads at once, none of which may modify the table.
+template<typename Key, typename Map>
+void checkConcurrentReads(const Map& map, const Reference& reference) {
+    std::vector<std::thread> readers;
+    for (size_t reader = 0; reader != Readers; ++reader) {
+        readers.emplace_back([&map, &reference, reader] {
+            for (uint64_t n = reader; n < KeyRange; n += Readers) {
+                checkFind<Key>(map, reference, n);
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+}
+
+template<typename Key, typename Storage, typename Growth>
+void run(const std::string& name, uint64_t seed) {
+    using Map = TestMap<Key, Storage, Growth>;
+    std::mt19937_64 rng(seed);
+    Map map;
+    Reference reference;
+    if (seed % 2 == 0) {
+        map.min_load_factor(0.1f);
+    }
+    for (size_t step = 0; step != Steps; ++step) {
+        uint64_t n = rng() % KeyRange;
+        Key key = makeKey<Key>(n);
+        switch (rng() % 16) {
+            case 0:
+            case 1:
+            case 2:
+            case 3: {
+                bool inserted = map.insert({key, step}).second;
+                CHECK(inserted == reference.insert({n, step}).second);
+                break;
+            }
+            case 4:
+                map[key] = step;
+                reference[n] = step;
+                break;
+            case 5:
+            case 6:
+            case 7:
+                checkFind<Key>(static_cast<const Map&>(map), reference, n);
+                CHECK((map.find(key) != map.end()) == (reference.count(n) != 0));
+                break;
+            case 8:
+            case 9:
+            case 10:
+                map.erase(key);
+                reference.erase(n);
+                CHECK(map.find(key) == map.end());
+                break;
+            case 11: {
+                // Every iterator written out must still be valid once the whole batch has been looked up.
+                std::vector<Key> keys;
+                for (size_t i = 0; i != 40; ++i) {
+                    keys.push_back(makeKey<Key>(rng() % KeyRange));
+                }
+                std::vector<typename Map::iterator> found;
+                map.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+                for (size_t i = 0; i != keys.size(); ++i) {
+                    auto expected = reference.find(keys[i].value);
+                    CHECK((found[i] != map.end()) == (expected != reference.end()));
+                    CHECK(found[i] == map.end() || found[i]->second == expected->second);
+                    if (found[i] != map.end()) {
+                        auto next = std::next(found[i]);
+                        CHECK(next == map.end() || reference.count(next->first.value) != 0);
+                    }
+                }
+                break;
+            }
+            case 12: {
+                std::vector<std::pair<Key, uint64_t>> entries;
+                for (size_t i = 0, count = rng() % 200; i != count; ++i) {
+                    entries.emplace_back(makeKey<Key>(rng() % KeyRange), step + i);
+                }
+                if (rng() % 2 == 0) {
+                    map.insert_bulk(entries.begin(), entries.end());
+                } else {
+                    map.insert_bulk(entries.begin(), entries.end(), 1 + rng() % 7);
+                }
+                for (const auto& entry : entries) {
+                    reference.insert({entry.first.value, entry.second});
+                }
+                break;
+            }
+            case 13:
+                if (step % 8 == 0) {
+                    map.reseed(rng());
+                }
+                break;
+            case 14:
+                if (step % 8 == 0) {
+                    map.rehash(rng() % (KeyRange * 2), 1 + rng() % 7);
+                }
+                break;
+            case 15:
+                if (step % 64 == 0) {
+                    map.shrink_to_fit();
+                } else if (step % 64 == 1) {
+                    map.reserve(map.size() * 2, 1 + rng() % 7);
+                } else if (step % 4096 == 2) {
+                    map.clear();
+                    reference.clear();
+                }
+                break;
+        }
+        CHECK(map.size() == reference.size());
+        if (step % 2000 == 0) {
+            checkAll<Key>(map, reference);
+            checkConcurrentReads<Key>(map, reference);
+        }
+    }
+    checkAll<Key>(map, reference);
+    std::printf("%s: ok\n", name.c_str());
+}
+
+template<typename Storage, typename Growth>
+void runAll(const std::string& name) {
+    run<StoredKey, Storage, Growth>(name + "/stored-hash", 1);
+    run<PlainKey, Storage, Growth>(name + "/plain", 2);
+}
+
+// Writers and readers of a ConcurrentHashMap whose storage migrates lazily.
+void concurrentMap() {
+    ConcurrentHashMap<uint64_t,
+                      uint64_t,
+                      std::hash<uint64_t>,
+                      std::equal_to<uint64_t>,
+                      std::allocator<std::pair<const uint64_t, uint64_t>>,
+                      IncrementalStorage>
+            map(4);
+    for (uint64_t n = 0; n != KeyRange; ++n) {
+        map.insert_or_assign(n, n);
+    }
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread != Readers; ++thread) {
+        threads.emplace_back([&map, thread] {
+            for (uint64_t n = 0; n != KeyRange; ++n) {
+                if (thread == 0) {
+                    map.insert_or_assign(KeyRange + n, n);
+                }
+                CHECK(map.contains(n));
+                auto value = map.find(n);
+                CHECK(value && *value == n);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(map.size() == KeyRange * 2);
+    std::printf("concurrent incremental: ok\n");
+}
+
+// Readers of an RcuHashMap each see a whole snapshot, never older than the last one they saw, while a writer
+// publishes new ones and frees the old under them; a snapshot freed too early shows up under
+// HASHMAP_SANITIZER=address or thread.
+void rcuMap() {
+    constexpr uint64_t Keys = 256;
+    constexpr uint64_t Rounds = 1000;
+    RcuHashMap<uint64_t, uint64_t> map;
+    map.update([](auto& snapshot) {
+        for (uint64_t n = 0; n != Keys; ++n) {
+            snapshot[n] = 0;
+        }
+    });
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (size_t reader = 0; reader != Readers; ++reader) {
+        readers.emplace_back([&map, &done, reader] {
+            uint64_t seen = 0;
+            while (!done.load()) {
+                uint64_t round = map.read([](const auto& snapshot) {
+                    uint64_t first = snapshot.at(0);
+                    CHECK(snapshot.size() == Keys || snapshot.size() == Keys + 1);
+                    for (const auto& entry : snapshot) {
+                        CHECK(entry.second == first);
+                    }
+                    return first;
+                });
+                CHECK(round >= seen);
+                auto value = map.find(reader);
+                CHECK(value && *value >= round);
+                seen = *value;
+            }
+        });
+    }
+    // Every write sets all values to the round, so a snapshot mixing two writes has two different values.
+    for (uint64_t round = 1; round != Rounds; ++round) {
+        map.update([round](auto& snapshot) {
+            for (auto& entry : snapshot) {
+                entry.second = round;
+            }
+        });
+        if (round % 2 == 0) {
+            map.insert({Keys, round});
+        } else {
+            map.erase(Keys);
+        }
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    CHECK(map.size() == Keys && map.at(0) == Rounds - 1 && !map.contains(Keys));
+    std::printf("rcu: ok\n");
+}
+
+}
+
+int main() {
+    runAll<ChainedStorage, PowerOfTwoGrowth>("chained/pow2");
+    runAll<ChainedStorage, PrimeGrowth>("chained/prime");
+    runAll<IncrementalStorage, PowerOfTwoGrowth>("incremental/pow2");
+    runAll<IncrementalStorage, PrimeGrowth>("incremental/prime");
+    runAll<FlatStorage, PowerOfTwoGrowth>("flat/pow2");
+    runAll<FlatStorage, PrimeGrowth>("flat/prime");
+    runAll<OrderedStorage, PowerOfTwoGrowth>("ordered/pow2");
+    runAll<OrderedStorage, PrimeGrowth>("ordered/prime");
+    concurrentMap();
+    rcuMap();
+}
@@ -0,0 +1,118 @@
+#include "HashMap.h"
+
+#include "check.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <utility>
+
+// IncrementalStorage must spread the work of growth over insertions: no single insertion may construct more
+// than a bounded number of buckets, however large the table gets. Shrinking, on the other hand, must release
+// the large array right away.
+
+namespace {
+
+// Counts every object constructed through it.
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    static inline size_t constructed = 0;
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ++CountingAllocator<char>::constructed;
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    friend bool operator==(const CountingAllocator&, const CountingAllocator&) {
+        return true;
+    }
+
+    friend bool operator!=(const CountingAllocator&, const CountingAllocator&) {
+        return false;
+    }
+};
+
+using Map = HashMap<uint64_t,
+                    uint64_t,
+                    std::hash<uint64_t>,
+                    std::equal_to<uint64_t>,
+                    CountingAllocator<std::pair<const uint64_t, uint64_t>>,
+                    IncrementalStorage>;
+
+void growthIsSpread() {
+    Map map;
+    size_t& constructed = CountingAllocator<char>::constructed;
+    size_t most = 0;
+    for (uint64_t key = 0; key != 300000; ++key) {
+        size_t before = constructed;
+        map.emplace(key, key);
+        if (map.bucket_count() > 1024) {
+            most = std::max(most, constructed - before);
+        }
+    }
+    CHECK(map.bucket_count() >= 524288);
+    // A slice of the next array and the entry itself.
+    CHECK(most <= 65);
+    for (uint64_t key = 0; key != 300000; ++key) {
+        CHECK(map.find(key) != map.end() && map.find(key)->second == key);
+    }
+    std::printf("incremental: growth spread ok, at most %zu constructions per insertion\n", most);
+}
+
+// Only the current bucket array is left, the old one released and no next one under way.
+bool holdsOneArray(const Map& map) {
+    return map.memory_usage().buckets == map.bucket_count() * sizeof(std::list<uint64_t>);
+}
+
+// Erasing down to a small fraction and shrinking drops the large array without waiting for insertions.
+void shrinkReleasesMemory() {
+    Map map;
+    for (uint64_t key = 0; key != 100000; ++key) {
+        map.emplace(key, key);
+    }
+    for (uint64_t key = 0; key != 99000; ++key) {
+        map.erase(key);
+    }
+    map.shrink_to_fit();
+    CHECK(map.bucket_count() < 4096 && holdsOneArray(map));
+    CHECK(map.stats().max_probe_length <= 8);
+
+    // The same through a minimum load factor, from a map that is still migrating.
+    map.clear();
+    map.min_load_factor(0.05f);
+    for (uint64_t key = 0; key != 100000; ++key) {
+        map.emplace(key, key);
+    }
+    for (uint64_t key = 0; key != 99000; ++key) {
+        map.erase(key);
+    }
+    CHECK(map.bucket_count() < 32768 && holdsOneArray(map));
+    for (uint64_t key = 99000; key != 100000; ++key) {
+        CHECK(map.find(key) != map.end() && map.find(key)->second == key);
+    }
+    std::printf("incremental: shrink ok\n");
+}
+
+}
+
+int main() {
+    growthIsSpread();
+    shrinkReleasesMemory();
+}
@@ -0,0 +1,193 @@
+#include "ConcurrentHashMap.h"
+#include "HashMap.h"
+
+#include "check.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+
+// pmr::HashMap must compile and work with every storage, and take all of its memory from the resource it was
+// given: polymorphic_allocator does not propagate on assignment, which rules out element assignment inside the
+// bucket containers.
+
+namespace {
+
+// Allocations from the global heap, not counting those a CountingResource passes on.
+size_t globalAllocations = 0;
+bool inResource = false;
+
+}
+
+void* operator new(size_t bytes) {
+    globalAllocations += !inResource;
+    if (void* p = std::malloc(bytes ? bytes : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+// Tracks the bytes it has handed out and not yet taken back, passing the requests on to the default resource.
+class CountingResource : public std::pmr::memory_resource {
+private:
+    size_t mLive = 0;
+    size_t mAllocations = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        mLive += bytes;
+        ++mAllocations;
+        inResource = true;
+        void* p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        inResource = false;
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        mLive -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    size_t live() const {
+        return mLive;
+    }
+
+    size_t allocations() const {
+        return mAllocations;
+    }
+};
+
+template<typename Storage>
+using Map = pmr::HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage>;
+
+template<typename Storage>
+void run(const char* name) {
+    CountingResource resource;
+    CountingResource other;
+    {
+        Map<Storage> map(&resource);
+        map.min_load_factor(0.1f);
+        for (int key = 0; key != 10000; ++key) {
+            map[key] = key;
+        }
+        for (int key = 0; key != 9000; ++key) {
+            map.erase(key);
+        }
+        map.reseed(42);
+        map.rehash(4096);
+        map.shrink_to_fit();
+        CHECK(map.size() == 1000 && map.find(9500) != map.end() && map.find(9500)->second == 9500);
+
+        // Assignment keeps the destination's resource, whichever side it came from.
+        Map<Storage> copy(&other);
+        copy = map;
+        Map<Storage> moved(&other);
+        moved = std::move(copy);
+        CHECK(moved.size() == 1000 && moved.find(9999) != moved.end());
+        CHECK(moved.get_allocator().resource() == &other);
+
+        map.clear();
+        for (int key = 0; key != 1000; ++key) {
+            map.try_emplace(key, key);
+        }
+        CHECK(map.size() == 1000 && resource.live() != 0);
+    }
+    CHECK(resource.live() == 0 && other.live() == 0);
+    std::printf("%s: pmr ok\n", name);
+}
+
+// A hash that is not noexcept makes the chained table compute where every node goes before moving any; that
+// scratch comes from the resource too.
+struct MayThrowHash {
+    size_t operator()(int key) const {
+        return std::hash<int>()(key);
+    }
+};
+
+void chainedRehashScratch() {
+    CountingResource resource;
+    {
+        pmr::HashMap<int, int, MayThrowHash, std::equal_to<int>, ChainedStorage> map(&resource);
+        for (int key = 0; key != 10000; ++key) {
+            map[key] = key;
+        }
+        size_t global = globalAllocations;
+        size_t allocations = resource.allocations();
+        map.rehash(100000);
+        CHECK(globalAllocations == global && resource.allocations() > allocations);
+        CHECK(map.size() == 10000 && map.find(1234) != map.end());
+    }
+    CHECK(resource.live() == 0);
+    std::printf("chained rehash: pmr ok\n");
+}
+
+// Every shard allocates from the resource the ConcurrentHashMap was given.
+void concurrentMap() {
+    CountingResource resource;
+    {
+        ConcurrentHashMap<int,
+                          int,
+                          std::hash<int>,
+                          std::equal_to<int>,
+                          std::pmr::polymorphic_allocator<std::pair<const int, int>>,
+                          FlatStorage>
+                map(4, {}, {}, &resource);
+        for (int key = 0; key != 10000; ++key) {
+            map.insert({key, key});
+        }
+        CHECK(map.size() == 10000 && resource.live() >= 10000 * sizeof(std::pair<const int, int>));
+    }
+    CHECK(resource.live() == 0);
+    std::printf("concurrent: pmr ok\n");
+}
+
+// Every snapshot an RcuHashMap publishes allocates from the resource it was given, not only the first one.
+void rcuMap() {
+    CountingResource resource;
+    {
+        RcuHashMap<int, int, std::hash<int>, std::equal_to<int>, std::pmr::polymorphic_allocator<std::pair<const int, int>>>
+                map({}, {}, &resource);
+        map.update([](auto& snapshot) {
+            for (int key = 0; key != 1000; ++key) {
+                snapshot[key] = key;
+            }
+        });
+        size_t live = resource.live();
+        map.update([](auto& snapshot) {
+            for (int key = 1000; key != 2000; ++key) {
+                snapshot[key] = key;
+            }
+        });
+        CHECK(map.size() == 2000 && resource.live() > live);
+        CHECK(map.read([](const auto& snapshot) { return snapshot.get_allocator().resource(); }) == &resource);
+    }
+    CHECK(resource.live() == 0);
+    std::printf("rcu: pmr ok\n");
+}
+
+}
+
+int main() {
+    run<ChainedStorage>("chained");
+    run<IncrementalStorage>("incremental");
+    run<FlatStorage>("flat");
+    run<OrderedStorage>("ordered");
+    chainedRehashScratch();
+    concurrentMap();
+    rcuMap();
+}
@@ -0,0 +1,220 @@
+#include "HashMap.h"
+
+#include "check.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reseeding, by hand and when a colliding chain triggers it, must leave every key findable and rejected as a
+// duplicate, through const and non-const lookups alike. Keys that do not collide must never trigger it.
+
+namespace {
+
+// The inverse of an odd number modulo 2^N, by Newton's iteration.
+constexpr size_t inverse(size_t odd) {
+    size_t x = odd;
+    for (int i = 0; i != 6; ++i) {
+        x *= 2 - odd * x;
+    }
+    return x;
+}
+
+// Undoes mixHash, so that under seed 0 every key is its own hash and keys can be picked to collide.
+struct UnmixHash {
+    size_t operator()(uint64_t key) const {
+        size_t hash = static_cast<size_t>(key);
+#if SIZE_MAX > 0xFFFFFFFFu
+        hash ^= hash >> 33;
+        hash *= inverse(0xc4ceb9fe1a85ec53ull);
+        hash ^= hash >> 33;
+        hash *= inverse(0xff51afd7ed558ccdull);
+        hash ^= hash >> 33;
+#else
+        hash ^= hash >> 16;
+        hash *= inverse(0xc2b2ae35u);
+        hash ^= hash >> 13 ^ hash >> 26;
+        hash *= inverse(0x85ebca6bu);
+        hash ^= hash >> 16;
+#endif
+        return hash;
+    }
+};
+
+template<typename Storage>
+using Map = HashMap<uint64_t,
+                    uint64_t,
+                    UnmixHash,
+                    std::equal_to<uint64_t>,
+                    std::allocator<std::pair<const uint64_t, uint64_t>>,
+                    Storage>;
+
+template<typename M>
+void checkContents(M& map, const std::vector<uint64_t>& keys) {
+    const M& constMap = map;
+    CHECK(map.size() == keys.size());
+    for (uint64_t key : keys) {
+        CHECK(constMap.find(key) != constMap.end() && constMap.find(key)->second == key * 3);
+        CHECK(map.find(key) != map.end());
+        CHECK(!map.insert({key, 0}).second);
+    }
+    CHECK(map.size() == keys.size());
+    size_t iterated = 0;
+    for (const auto& entry : constMap) {
+        CHECK(entry.second == entry.first * 3);
+        ++iterated;
+    }
+    CHECK(iterated == keys.size());
+}
+
+template<typename Storage>
+void manualReseed(const char* name) {
+    Map<Storage> map;
+    std::vector<uint64_t> keys;
+    for (uint64_t key = 0; key != 3334; ++key) {
+        map.emplace(key, key * 3);
+        keys.push_back(key);
+        if (key == 1000) {
+            // Leaves IncrementalStorage with a migration under way.
+            map.rehash(map.bucket_count() * 4);
+        }
+    }
+    map.reseed(99);
+    CHECK(map.seed() == 99);
+    checkContents(map, keys);
+    map.reseed(12345);
+    checkContents(map, keys);
+    std::printf("%s: manual reseed ok\n", name);
+}
+
+// Keys whose hashes under seed 0 agree in their low 24 bits share a chain or probe sequence until the map
+// reseeds itself; a thousand of them outrun every storage's default threshold.
+template<typename Storage>
+void automaticReseed(const char* name) {
+    Map<Storage> map;
+    map.reseed(0);
+    std::vector<uint64_t> keys;
+    for (uint64_t n = 1; n != 1000; ++n) {
+        keys.push_back(n << 24);
+    }
+    for (uint64_t key = 1; keys.size() != 20000; ++key) {
+        keys.push_back(key);
+    }
+    for (uint64_t key : keys) {
+        map.emplace(key, key * 3);
+    }
+    CHECK(map.seed() != 0);
+    checkContents(map, keys);
+    std::printf("%s: automatic reseed ok\n", name);
+}
+
+// Random keys grown through many doublings, each filled to the maximum load, keep the seed they started with,
+// at the default load and at a high one alike.
+template<typename Storage>
+void randomKeysKeepSeed(const char* name, float maxLoadFactor) {
+    Map<Storage> map;
+    map.max_load_factor(maxLoadFactor);
+    map.reseed(7);
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i != 1500000; ++i) {
+        map.emplace(rng(), 0);
+    }
+    CHECK(map.seed() == 7);
+    std::printf("%s: no reseed on random keys at load %g\n", name, maxLoadFactor);
+}
+
+// The default threshold follows max_load_factor(); one set by hand stays.
+template<typename Storage>
+void thresholdFollowsLoad(const char* name, float maxLoadFactor) {
+    Map<Storage> map;
+    size_t threshold = map.reseed_threshold();
+    map.max_load_factor(maxLoadFactor);
+    CHECK(map.reseed_threshold() > threshold);
+    map.reseed_threshold(threshold);
+    map.max_load_factor(map.max_load_factor() / 2);
+    CHECK(map.reseed_threshold() == threshold);
+    std::printf("%s: reseed threshold ok\n", name);
+}
+
+// 16-byte strings on which libstdc++'s std::hash, an unseeded MurmurHash2, agrees: the second word of each
+// undoes the difference the first one made to the hash state. Elsewhere the strings merely differ.
+std::vector<std::string> collidingStrings(size_t count) {
+    constexpr uint64_t Mul = 0xc6a4a7935bd1e995ull;
+    constexpr uint64_t Inverse = inverse(Mul);
+    auto shiftMix = [](uint64_t v) {
+        return v ^ v >> 47;
+    };
+    uint64_t start = 0xc70f6907ull ^ 16 * Mul;
+    std::vector<std::string> strings;
+    for (uint64_t first = 0; first != count; ++first) {
+        uint64_t state = (start ^ shiftMix(first * Mul) * Mul) * Mul;
+        // shiftMix is its own inverse.
+        uint64_t second = shiftMix(state * Inverse) * Inverse;
+        std::string bytes(16, '\0');
+        std::memcpy(&bytes[0], &first, 8);
+        std::memcpy(&bytes[8], &second, 8);
+        strings.push_back(bytes);
+    }
+    return strings;
+}
+
+// Strings whose whole std::hash values agree end up in one chain or probe sequence under any seed mixed into
+// that hash; the map hashes them under its seed instead, so the reseed they trigger separates them.
+template<typename Storage>
+void collidingStringsSeparate(const char* name) {
+    std::vector<std::string> keys = collidingStrings(1000);
+    if (SIZE_MAX <= 0xFFFFFFFFu || std::hash<std::string>()(keys[0]) != std::hash<std::string>()(keys[1])) {
+        std::printf("%s: colliding strings skipped, std::hash differs\n", name);
+        return;
+    }
+    HashMap<std::string,
+            size_t,
+            std::hash<std::string>,
+            std::equal_to<std::string>,
+            std::allocator<std::pair<const std::string, size_t>>,
+            Storage>
+            map;
+    for (size_t i = 0; i != keys.size(); ++i) {
+        map.emplace(keys[i], i);
+    }
+    CHECK(map.size() == keys.size() && map.stats().max_probe_length <= map.reseed_threshold());
+    HashMap<std::string_view,
+            size_t,
+            std::hash<std::string_view>,
+            std::equal_to<std::string_view>,
+            std::allocator<std::pair<const std::string_view, size_t>>,
+            Storage>
+            views;
+    for (size_t i = 0; i != keys.size(); ++i) {
+        views.emplace(keys[i], i);
+    }
+    CHECK(views.size() == keys.size() && views.stats().max_probe_length <= views.reseed_threshold());
+    for (size_t i = 0; i != keys.size(); ++i) {
+        CHECK(map.at(keys[i]) == i && views.at(keys[i]) == i);
+    }
+    std::printf("%s: colliding strings separated\n", name);
+}
+
+template<typename Storage>
+void run(const char* name, float highLoad) {
+    manualReseed<Storage>(name);
+    automaticReseed<Storage>(name);
+    randomKeysKeepSeed<Storage>(name, Map<Storage>().max_load_factor());
+    randomKeysKeepSeed<Storage>(name, highLoad);
+    thresholdFollowsLoad<Storage>(name, highLoad);
+    collidingStringsSeparate<Storage>(name);
+}
+
+}
+
+int main() {
+    run<ChainedStorage>("chained", 8);
+    run<IncrementalStorage>("incremental", 8);
+    run<FlatStorage>("flat", 0.95f);
+    run<OrderedStorage>("ordered", 0.9f);
+}
@@ -0,0 +1,247 @@
+#include "HashMap.h"
+
+#include "check.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// A Hash or a key copy that throws partway through a rehash must leave the map as it was, whether the rehash
+// came from growth, shrinking or reseed().
+
+namespace {
+
+// Keeps its hash next to it, so that reseed() has stored hashes to replace.
+struct StoredKey {
+    uint64_t value;
+
+    friend bool operator==(const StoredKey& lhs, const StoredKey& rhs) {
+        return lhs.value == rhs.value;
+    }
+};
+
+}
+
+template<>
+struct StoreHash<StoredKey> : std::true_type {};
+
+namespace {
+
+struct ThrowingHash {
+    // Calls left before the next one throws; negative never throws.
+    static inline long countdown = -1;
+
+    size_t operator()(const StoredKey& key) const {
+        return (*this)(key.value);
+    }
+
+    size_t operator()(uint64_t key) const {
+        if (countdown == 0) {
+            countdown = -1;
+            throw std::runtime_error("hash failed");
+        }
+        if (countdown > 0) {
+            --countdown;
+        }
+        return static_cast<size_t>(key);
+    }
+};
+
+template<typename Storage, typename Key = uint64_t>
+using Map = HashMap<Key,
+                    uint64_t,
+                    ThrowingHash,
+                    std::equal_to<Key>,
+                    std::allocator<std::pair<const Key, uint64_t>>,
+                    Storage>;
+
+template<typename M>
+size_t countFound(const M& map, uint64_t keys) {
+    using Key = std::remove_const_t<decltype(map.begin()->first)>;
+    size_t found = 0;
+    for (uint64_t key = 0; key != keys; ++key) {
+        found += map.find(Key{key}) != map.end();
+    }
+    return found;
+}
+
+template<typename M>
+size_t countIterated(const M& map) {
+    size_t iterated = 0;
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        ++iterated;
+    }
+    return iterated;
+}
+
+// The old seed stays, and every entry is still placed by it.
+template<typename Storage, typename Key>
+void reseedKeepsMap(const char* name) {
+    Map<Storage, Key> map;
+    for (uint64_t key = 0; key != 1000; ++key) {
+        map.emplace(Key{key}, key);
+    }
+    size_t seed = map.seed();
+    ThrowingHash::countdown = 500;
+    bool threw = false;
+    try {
+        map.reseed(seed + 1);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(map.seed() == seed && map.size() == 1000 && countIterated(map) == 1000);
+    CHECK(countFound(map, 1000) == 1000);
+    for (uint64_t key = 0; key != 1000; ++key) {
+        CHECK(!map.emplace(Key{key}, key).second);
+    }
+    map.reseed(seed + 1);
+    CHECK(map.seed() == seed + 1 && countFound(map, 1000) == 1000);
+    std::printf("%s: throwing reseed ok\n", name);
+}
+
+// Growth and shrinking relink ChainedStorage's nodes only once every hash is known, so a failure leaves the
+// table as it was: every key still found where lookups search for it, and rejected as a duplicate.
+void chainedRehashKeepsTable() {
+    for (size_t bucketCount : {size_t(4096), size_t(64)}) {
+        Map<ChainedStorage> map;
+        for (uint64_t key = 0; key != 1000; ++key) {
+            map.emplace(key, key);
+        }
+        // Lets 64 buckets hold them all, so that the second pass shrinks.
+        map.max_load_factor(16);
+        size_t oldCount = map.bucket_count();
+        ThrowingHash::countdown = 300;
+        bool threw = false;
+        try {
+            map.rehash(bucketCount);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+        CHECK(map.size() == 1000 && map.bucket_count() == oldCount && countIterated(map) == 1000);
+        CHECK(countFound(map, 1000) == 1000);
+        for (uint64_t key = 0; key != 1000; ++key) {
+            CHECK(!map.emplace(key, key).second);
+        }
+        CHECK(map.size() == 1000);
+        map.clear();
+        CHECK(countIterated(map) == 0 && countFound(map, 1000) == 0);
+    }
+    std::printf("chained: throwing rehash ok\n");
+}
+
+// FlatStorage moves the values into a new table, which must not start before every hash is known.
+void flatRehashKeepsValues() {
+    HashMap<uint64_t,
+            std::string,
+            ThrowingHash,
+            std::equal_to<uint64_t>,
+            std::allocator<std::pair<const uint64_t, std::string>>,
+            FlatStorage>
+            map;
+    for (uint64_t key = 0; key != 1000; ++key) {
+        map.emplace(key, std::string(32, 'a' + key % 26));
+    }
+    size_t bucketCount = map.bucket_count();
+    ThrowingHash::countdown = 500;
+    bool threw = false;
+    try {
+        map.rehash(bucketCount * 4);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(map.size() == 1000 && map.bucket_count() == bucketCount && countIterated(map) == 1000);
+    for (uint64_t key = 0; key != 1000; ++key) {
+        auto it = map.find(key);
+        CHECK(it != map.end() && it->second == std::string(32, 'a' + key % 26));
+    }
+    std::printf("flat: throwing rehash ok\n");
+}
+
+// A key whose copy throws on request and whose move is not noexcept, so that tables must copy it to relocate it.
+struct ThrowingCopyKey {
+    // Copies left before the next one throws; negative never throws.
+    static inline long countdown = -1;
+
+    uint64_t value;
+
+    explicit ThrowingCopyKey(uint64_t value) : value(value) {}
+
+    ThrowingCopyKey(const ThrowingCopyKey& rhs) : value(rhs.value) {
+        if (countdown == 0) {
+            countdown = -1;
+            throw std::runtime_error("copy failed");
+        }
+        if (countdown > 0) {
+            --countdown;
+        }
+    }
+
+    ThrowingCopyKey(ThrowingCopyKey&& rhs) noexcept(false) : value(rhs.value) {}
+
+    bool operator==(const ThrowingCopyKey& rhs) const {
+        return value == rhs.value;
+    }
+};
+
+struct ThrowingCopyKeyHash {
+    size_t operator()(const ThrowingCopyKey& key) const {
+        return static_cast<size_t>(key.value);
+    }
+};
+
+// A key copy that throws while FlatStorage grows or OrderedStorage compacts leaves every entry with its value,
+// found by lookups and rejected as a duplicate.
+template<typename Storage>
+void relocationKeepsTable(const char* name) {
+    HashMap<ThrowingCopyKey,
+            std::string,
+            ThrowingCopyKeyHash,
+            std::equal_to<ThrowingCopyKey>,
+            std::allocator<std::pair<const ThrowingCopyKey, std::string>>,
+            Storage>
+            map;
+    map.reserve(2000);
+    for (uint64_t key = 0; key != 2000; ++key) {
+        map.emplace(ThrowingCopyKey(key), std::string(32, 'a' + key % 26));
+    }
+    // Leaves OrderedStorage with holes to compact.
+    for (uint64_t key = 0; key != 1000; ++key) {
+        map.erase(ThrowingCopyKey(key * 2));
+    }
+    ThrowingCopyKey::countdown = 300;
+    bool threw = false;
+    try {
+        map.rehash(map.bucket_count() * 4);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(map.size() == 1000 && countIterated(map) == 1000);
+    for (uint64_t key = 1; key < 2000; key += 2) {
+        auto it = map.find(ThrowingCopyKey(key));
+        CHECK(it != map.end() && it->second == std::string(32, 'a' + key % 26));
+        CHECK(!map.emplace(ThrowingCopyKey(key), std::string()).second);
+    }
+    CHECK(map.size() == 1000);
+    std::printf("%s: throwing relocation ok\n", name);
+}
+
+}
+
+int main() {
+    reseedKeepsMap<ChainedStorage, uint64_t>("chained");
+    reseedKeepsMap<ChainedStorage, StoredKey>("chained, stored hashes");
+    reseedKeepsMap<IncrementalStorage, uint64_t>("incremental");
+    reseedKeepsMap<FlatStorage, uint64_t>("flat");
+    reseedKeepsMap<FlatStorage, StoredKey>("flat, stored hashes");
+    reseedKeepsMap<OrderedStorage, uint64_t>("ordered");
+    chainedRehashKeepsTable();
+    flatRehashKeepsValues();
+    relocationKeepsTable<FlatStorage>("flat");
+    relocationKeepsTable<OrderedStorage>("ordered");
+}